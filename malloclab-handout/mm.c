@@ -6,23 +6,44 @@
  * @date 2020-12-18 ~ 12-19
  * Implementation of @c malloc , @c free , @c realloc and @c calloc .
  * Based on Segregated fit lists, with:
- * - *First Free* policy of placement
+ * - *First Free* policy of placement, *Best Fit* for large blocks
  * - LIFO free block ordering
  * - Bundary tag coalescing
+ * - Multiple arenas, so that threads allocate in parallel
+ * - Per-thread caches of small blocks
+ * - Headerless small objects in page-sized spans
+ * - In-place re-allocation
+ * - Large blocks mapped by @c mmap , re-allocated by @c mremap
+ * - Pages of large free blocks returned to the system
+ * - Heap extended geometrically, by up to @c GROW_MAX_SIZE at once
+ * - Requests rounded up to frequent sizes when that avoids fragmentation
+ * - Aligned allocation, and a build as shared library replacing @c malloc
+ *   of libc (with @c PRELOAD defined, see @c Makefile.preload )
  * @copyright Copyright (c) 2020 Guyutongxue
  *
  */
 
+#define _GNU_SOURCE  // For mremap
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#ifndef DRIVER
+#include <pthread.h>
+#endif
+#include <sched.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "./mm.h"
+#ifndef PRELOAD
 #include "./memlib.h"
+#endif
 
 #ifndef __GNUC__
 #error This file must be compiled under GCC.
@@ -57,11 +78,16 @@
 #define calloc mm_calloc
 #endif /* def DRIVER */
 
-// Alignment set to double word.
+// Alignment set to double word, or 16 bytes by -DALIGNMENT=16
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
+#if ALIGNMENT != 8 && ALIGNMENT != 16
+#error ALIGNMENT must be 8 or 16.
+#endif
 
 /// Rounds up to the nearest multiple of @c ALIGNMENT
-#define ALIGN(p) (((size_t)(p) + ((ALIGNMENT)-1)) & ~0x7)
+#define ALIGN(p) (((size_t)(p) + ((ALIGNMENT)-1)) & ~(size_t)((ALIGNMENT)-1))
 
 // Basic types and sizes
 typedef uint32_t WORD;   ///< WORD is 32-bit
@@ -95,17 +121,254 @@ typedef uint64_t DWORD;  ///< DWORD (double WORD) is 64-bit
  *
  * HEADER & FOOTER:
  * +-------------------------------------+---+---+---+
- * |        SIZE (first 29 bits)         |   | B | A |
+ * |        SIZE (first 29 bits)         | M | B | A |
  * +-------------------------------------+---+---+---+
  *                  29b                    1b  1b  1b
  * A - Is allocated?
  * B - Boundary tag
+ * M - Is mapped? (in header of mapped chunks, see below)
+ *     Is purged? (in header of free blocks, see below)
  *
  */
 #define MIN_PAYLOAD_SIZE 12   ///< Minimal payload alignment
 #define MIN_BLOCK_SIZE 16     ///< Minimal block size
 #define INIT_SIZE (1 << 6)    ///< Initial heap size
-#define CHUNK_SIZE (1 << 12)  ///< Extend heap by this amount
+#define CHUNK_SIZE (1 << 12)  ///< Min amount to extend heap by
+
+/* Explanation of arenas:
+ *
+ * Each arena has its own seglists and lock, and owns some *segments* of
+ * the heap. A segment is a run of blocks between a prologue and an
+ * epilogue:
+ * +-----+----------+----------+-----+-----+----------+
+ * | PAD | PROLOGUE | PROLOGUE | ... | ... | EPILOGUE |
+ * |     |  HEADER  |  FOOTER  |     |     |  HEADER  |
+ * +-----+----------+----------+-----+-----+----------+
+ *   4B       4B         4B      blocks         4B
+ * An arena extends its last segment if it still ends at the break;
+ * otherwise (another arena has extended the heap since) it starts a new
+ * segment at the next page boundary. So every page belongs to at most one
+ * arena, which is recorded in @c page_arena for @c free to find the owner.
+ * Threads are assigned to arenas round-robin on their first allocation.
+ * A block freed by a thread of another arena is not freed under the owner's
+ * lock, but pushed to the owner's lock-free @c remote list (linked through
+ * payload like tcache); the owner's next allocation frees them all.
+ */
+#define ARENA_NUM 8                 ///< How many arenas
+#define PAGE_SHIFT 12               ///< Log2 of @c PAGE_SIZE
+#define PAGE_SIZE (1 << PAGE_SHIFT)  ///< Granularity of segments
+#define SEGMENT_OVERHEAD (4 * WORD_SIZE)  ///< Pad, prologue and epilogue
+/// Max heap size, since free block links are 32-bit offsets
+#define MAX_HEAP_SIZE ((size_t)1 << 32)
+
+/* Explanation of heap growth:
+ *
+ * An arena extends heap by at least @c grow bytes, which starts at
+ * @c CHUNK_SIZE and doubles on every extension up to @c GROW_MAX_SIZE , so
+ * that a burst of allocations calls @c mem_sbrk only a few times, while a
+ * small program stays small; pages never touched cost no memory anyway.
+ * The policy is set at build time: -DGROW_MAX_SIZE=4096 keeps the fixed
+ * extension, and -DGROW_HUGE rounds the break up to @c HUGE_PAGE_SIZE , and
+ * asks for the heap to be backed by huge pages in the shared library.
+ */
+#ifndef GROW_MAX_SIZE
+#ifdef DRIVER
+// Space extended but not used only lowers utilization in mdriver
+#define GROW_MAX_SIZE CHUNK_SIZE
+#else
+#define GROW_MAX_SIZE (1 << 22)
+#endif
+#endif
+#define HUGE_PAGE_SIZE (1 << 21)  ///< Size of a transparent huge page
+
+/* Explanation of tcache:
+ *
+ * Each thread caches recently freed small blocks in @c tcache , one LIFO
+ * list per block size (or span object size, which never collide since span
+ * objects are at most @c SPAN_MAX_SIZE bytes, while other blocks are
+ * larger), linked through the first 8 bytes of payload. Cached
+ * blocks are still marked allocated in the heap, so @c malloc and @c free
+ * of them touch neither the arena nor its lock. An empty list is filled
+ * with @c TCACHE_BATCH blocks under one lock; a full list drains its
+ * older half back into arenas likewise.
+ */
+#define TCACHE_BINS 32  ///< How many cached sizes
+/// Max blocks in a tcache list
+#ifdef DRIVER
+// mdriver is single-threaded and scores utilization, which cached blocks
+// (never coalesced) only hurt; so tcache is off there
+#define TCACHE_COUNT 0
+#else
+#define TCACHE_COUNT 8
+#endif
+#define TCACHE_BATCH (TCACHE_COUNT / 2)  ///< Blocks to fill or drain at once
+/// Max block size cached
+#define TCACHE_MAX_SIZE (TCACHE_BINS * ALIGNMENT)
+/// Get the tcache index of block @c size
+#define TCACHE_INDEX(size) ((size) / ALIGNMENT - 1)
+/// Get/Set the next block in tcache list
+#define GET_NEXT_CACHED(bp) (*(void**)(bp))
+#define SET_NEXT_CACHED(bp, val) (*(void**)(bp) = (val))
+
+/* Explanation of quick lists:
+ *
+ * A freed block of at most @c QUICK_MAX_SIZE bytes is not coalesced at
+ * once, but pushed to a LIFO list of its arena for its size, still marked
+ * allocated and linked like tcache, so that a later request of the same
+ * size takes it back without touching neighbours or seglists. Coalescing is
+ * deferred: all quick lists are freed for real when a request finds no fit,
+ * before extending heap, or when @c QUICK_LIMIT blocks are held already.
+ */
+#define QUICK_MAX_SIZE (1 << 9)  ///< Max block size kept in quick lists
+#define QUICK_BINS (QUICK_MAX_SIZE / ALIGNMENT)  ///< How many quick lists
+/// Get the quick list index of block @c size
+#define QUICK_INDEX(size) ((size) / ALIGNMENT - 1)
+#define QUICK_LIMIT 64  ///< Max blocks in quick lists of an arena
+
+/* Explanation of size rounding:
+ *
+ * Free blocks of one size are of no use to a request slightly larger, so
+ * heap grows while they stay free; e.g. a program allocates 448-byte
+ * blocks between 64-byte ones, frees them, then allocates 512-byte ones.
+ * So each thread counts the block sizes it requests, up to
+ * @c ROUND_MAX_SIZE (larger free blocks are split by best fit anyway), and
+ * how often a request of each size extends heap while free blocks at most
+ * a fifth smaller are left: evidence that rounding would reduce
+ * fragmentation. Every @c ROUND_PERIOD requests, each size is mapped to
+ * the most frequent size at most a quarter larger which starves so (for
+ * 1/16 of its requests) and is at least a quarter as frequent; requests
+ * are rounded up accordingly, so that both sizes share their blocks.
+ * Counts are halved every @c ROUND_DECAY requests, to follow recent sizes,
+ * and survive @c mm_init , as sizes belong to the program, not the heap.
+ */
+#define ROUND_MAX_SIZE (1 << 10)  ///< Max block size rounded
+#define ROUND_BINS (ROUND_MAX_SIZE / ALIGNMENT)  ///< How many sizes counted
+/// Get the histogram index of block @c size
+#define ROUND_INDEX(size) ((size) / ALIGNMENT - 1)
+#define ROUND_PERIOD (1 << 8)  ///< Requests between updates of rounding
+#define ROUND_DECAY (1 << 12)  ///< Requests between halving counts
+
+/* Explanation of a span:
+ *
+ * Requests of at most @c SPAN_MAX_SIZE bytes are served from spans, each
+ * the payload of an allocated block, starting at a page boundary (relative
+ * to @c mem_heap_lo ) and dedicated to one object size:
+ * +--------+--------+--------+--------+-----+
+ * | SPAN   | OBJECT | OBJECT | OBJECT | ... |
+ * | HEADER |        |        |        |     |
+ * +--------+--------+--------+--------+-----+
+ *    32B    ^ no header
+ * The page is recorded in @c page_span , so @c free tells a span object by
+ * its page, and finds the span header by rounding down to the page. Free
+ * objects are linked by their offset in span; objects never used are
+ * handed out by bumping @c bump . Spans with free objects are listed in
+ * their arena. An empty span is freed, unless it is the only one listed.
+ */
+/// How many object sizes
+#ifdef DRIVER
+// mdriver traces are too small to fill a page of each size; only spans of
+// the smallest sizes, whose headers cost most, pay off there
+#define SPAN_CLASSES 2
+#else
+#define SPAN_CLASSES 8
+#endif
+#define SPAN_MAX_SIZE (SPAN_CLASSES * ALIGNMENT)  ///< Max object size
+/// Size of the block holding a span, so that spans may be in adjacent pages
+#define SPAN_BLOCK_SIZE PAGE_SIZE
+/// Get how many objects of @c size a span holds (the last word of page is
+/// header of the next block)
+#define SPAN_CAPACITY(size) \
+  ((PAGE_SIZE - WORD_SIZE - sizeof(span_t)) / (size))
+/// Get the object size of span class @c cls , which is 1-based
+#define SPAN_CLASS_SIZE(cls) ((cls)*ALIGNMENT)
+/// Get the page index of @c p
+#define PAGE_OF(p) ((size_t)((char*)(p) - (char*)mem_heap_lo()) >> PAGE_SHIFT)
+/// Get the span header of an object
+#define SPAN_OF(bp) \
+  ((span_t*)((char*)mem_heap_lo() + (PAGE_OF(bp) << PAGE_SHIFT)))
+
+/* Explanation of a mapped chunk:
+ *
+ * Requests of at least @c mmap_threshold bytes are not served from heap,
+ * but each mapped by its own @c mmap , so that @c free returns the memory
+ * at once, and @c realloc resizes it by @c mremap without copying:
+ * +-------+----------+--------+--------+---------------------------+
+ * |  ...  | MAP SIZE | OFFSET | HEADER |          PAYLOAD          |
+ * +-------+----------+--------+--------+---------------------------+
+ * ^            8B        4B       4B   ^
+ * start of mapping                     bp
+ * OFFSET is that of @c bp in mapping, which is @c MAP_OVERHEAD unless
+ * @c bp is aligned by @c memalign . The header has bit M set. Since span
+ * objects have no header, it is only looked at for addresses beyond the
+ * pages of heap.
+ */
+/// Initial min request size mapped. Freeing a larger chunk (up to
+/// @c MMAP_MAX_THRESHOLD ) raises it to the size of the chunk, as glibc
+/// does: a program freeing such a chunk likely asks for one again, and
+/// mapping it anew every time costs a page fault per page.
+#ifdef DRIVER
+// mdriver checks that every block lies in heap; so nothing is mapped there
+#define MMAP_THRESHOLD SIZE_MAX
+#else
+#define MMAP_THRESHOLD (1 << 17)
+#endif
+#define MMAP_MAX_THRESHOLD (1 << 25)       ///< Max @c mmap_threshold
+#define MAPPED 0x4                         ///< Bit M of header
+#define MAP_OVERHEAD (2 * DWORD_SIZE)      ///< Map size, offset and header
+/// Get the offset in mapping/start/size of mapping of a mapped chunk
+#define MAP_OFFSET(bp) GET_WORD((char*)(bp)-DWORD_SIZE)
+#define MAP_BASE(bp) ((char*)(bp)-MAP_OFFSET(bp))
+#define MAP_SIZE(bp) (*(size_t*)((char*)(bp)-MAP_OVERHEAD))
+/// Whether @c bp is a mapped chunk
+#define IS_MAPPED(bp) \
+  (PAGE_OF(bp) >= page_used && (GET_WORD(GET_HEADER(bp)) & MAPPED))
+/// Rounds up to a multiple of @c PAGE_SIZE
+#define PAGE_ALIGN(n) \
+  (((size_t)(n) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1))
+
+/* Explanation of purging:
+ *
+ * Pages inside a free block of at least @c PURGE_MIN_SIZE bytes are given
+ * back to the system by @c madvise , keeping the header, links and footer
+ * in place; the block is then marked by bit M (here meaning *purged*) of
+ * its header, which is cleared as soon as the header is rewritten. Since
+ * @c mem_sbrk never shrinks the heap, this is also how heap is trimmed: a
+ * free block at the break of at least @c trim_threshold bytes is purged
+ * once freed. Other blocks, which are likely reused soon, are purged
+ * lazily: a large free block is stamped with the time it is put into the
+ * treap, after its links, and freeing a large block purges the blocks of
+ * its arena free for @c PURGE_DECAY milliseconds, at most once as often.
+ * Pages purged read as zero, and so does fresh heap in the shared library
+ * build, which is marked purged as well; @c calloc clears only the rest.
+ */
+/// Min size of free blocks purged, at least @c TREE_MIN_SIZE
+#ifdef DRIVER
+// Purging never improves utilization in mdriver, while page faults after it
+// cost throughput
+#define PURGE_MIN_SIZE SIZE_MAX
+#else
+#define PURGE_MIN_SIZE (1 << 16)
+#endif
+#define PURGE_DECAY 1000  ///< Min interval of lazy purging, in ms
+/// Initial min size of free block at the break purged at once; kept at
+/// least twice @c mmap_threshold , so that chunks moved into heap by it are
+/// not trimmed on every free
+#define TRIM_THRESHOLD (1 << 20)
+/// Get/Set when free block @c bp was put into treap, in ms
+#define FREE_TIME(bp) (*(uint64_t*)((char*)(bp) + DWORD_SIZE))
+#define PURGED MAPPED     ///< Bit M of header of free blocks
+/// Begin of pages purged in free block @c bp , after its links
+#define PURGE_BEGIN(bp) ((char*)PAGE_ALIGN((char*)(bp) + DWORD_SIZE))
+/// End of pages purged in free block @c bp , before its footer
+#define PURGE_END(bp) \
+  ((char*)((size_t)GET_FOOTER(bp) & ~(size_t)(PAGE_SIZE - 1)))
+/// Whether @c mem_sbrk returns zero memory; memlib of mdriver hands out the
+/// same memory again after @c mem_reset_brk
+#ifdef PRELOAD
+#define HEAP_ZEROED 1
+#else
+#define HEAP_ZEROED 0
+#endif
 
 /// Get the greater value of @c x and @c y
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
@@ -166,31 +429,200 @@ typedef uint64_t DWORD;  ///< DWORD (double WORD) is 64-bit
   PUT_WORD((char*)(bp) + WORD_SIZE, \
            (WORD)((val) ? ((char*)(val)-heap_begin) : 0))
 
-/// Automatic choose appropriate seglist index
-#define SEGLIST_AUTO ((size_t)-1)
+/* Explanation of seglist classes:
+ *
+ * Each power of 2 is split into 4 classes, so a size is mapped to
+ * ( @c log2(size) - 4 ) * 4 plus its 2 bits after the leading 1. As every
+ * block in a higher class is larger than every block in a lower one, any
+ * block in a class above that of the request fits; the first of them is
+ * found by a count-trailing-zeros on @c seg_map , a bitmap of non-empty
+ * classes. Only the head of the request's own class is tried besides.
+ *
+ * Free blocks of at least @c TREE_MIN_SIZE bytes are not in seglists, but
+ * in a treap ordered by (size, address), reusing NEXT_FREE and PREV_FREE as
+ * offsets of left and right children. Priorities are hashes of addresses,
+ * so they need no space. The least block not smaller than the request is
+ * the best fit, with lowest address among equal sizes.
+ */
+#define SEGLIST_SUB_BITS 2  ///< Log2 of classes per power of 2
+/// How many seglist, up to sizes of 2^32
+#define SEGLIST_SIZE ((32 - 4) << SEGLIST_SUB_BITS)
+/// How many 64-bit words in bitmap of seglists
+#define SEGLIST_MAP_SIZE ((SEGLIST_SIZE + 63) / 64)
+/// Min size of free blocks in treap, must be a power of 2
+#define TREE_MIN_SIZE (1 << 10)
 
-/// How many seglist
-#define SEGLIST_SIZE 17
+/// Get/Set children of a free block in treap ( @c val evaluated once)
+#define GET_LEFT_CHILD(bp) GET_NEXT_FREE(bp)
+#define GET_RIGHT_CHILD(bp) GET_PREV_FREE(bp)
+#define SET_LEFT_CHILD(bp, val)   \
+  ({                              \
+    char* child_ = (val);         \
+    SET_NEXT_FREE((bp), child_);  \
+  })
+#define SET_RIGHT_CHILD(bp, val)  \
+  ({                              \
+    char* child_ = (val);         \
+    SET_PREV_FREE((bp), child_);  \
+  })
 
-/// The begin position of available heap ( @c bp of prologue)
+/// The begin position of available heap ( @c bp of first prologue)
 static char* heap_begin = NULL;
 
-/// Array of seglists
-static void** seglist;
+/// Header of a span
+typedef struct span {
+  struct span* next;  ///< Next span in list of arena
+  struct span* prev;  ///< Previous span in list of arena
+  WORD free;          ///< Offset of first free object, 0 if none
+  WORD bump;          ///< Offset of first never used object
+  WORD used;          ///< How many objects allocated
+  WORD size;          ///< Object size
+} span_t;
+
+/// An independent heap
+typedef struct {
+  char lock;                   ///< Spin lock of this arena
+  char* seg_end;               ///< End of its last segment, NULL if none
+  void* remote;                ///< Blocks freed by other arenas' threads
+  void* seglist[SEGLIST_SIZE]; ///< Array of seglists
+  uint64_t seg_map[SEGLIST_MAP_SIZE];  ///< Bitmap of non-empty seglists
+  char* tree;                  ///< Root of treap of large free blocks
+  span_t* spans[SPAN_CLASSES]; ///< Spans with free objects of each size
+  uint64_t purge_time;         ///< When last purged, in ms
+  void* quick[QUICK_BINS];     ///< Quick lists of freed blocks
+  unsigned quick_count;        ///< How many blocks in quick lists
+  size_t grow;                 ///< Min size of next extension, 0 if none
+} arena_t;
+
+/// All arenas
+static arena_t arenas[ARENA_NUM];
+
+/// Index of arena owning each page of heap (default 0)
+static unsigned char page_arena[MAX_HEAP_SIZE >> PAGE_SHIFT];
+
+/// Span class (1-based) of each page of heap, 0 if not a span
+static unsigned char page_span[MAX_HEAP_SIZE >> PAGE_SHIFT];
+
+/// How many pages in @c page_arena and @c page_span may be non-zero
+static size_t page_used = 0;
+
+/// Lock of @c mem_sbrk and @c page_arena
+static char sbrk_lock = 0;
+
+/// Next arena to assign
+static unsigned next_arena = 0;
+
+/// Min request size mapped, and min size of free block at the break purged
+/// at once, see above
+static size_t mmap_threshold = MMAP_THRESHOLD;
+static size_t trim_threshold = TRIM_THRESHOLD;
+
+/// Incremented by @c mm_init , so that threads re-assign their arenas;
+/// never 0, which is @c thread_gen of new threads
+static unsigned heap_gen = 1;
+
+/// Arena of current thread, valid if @c thread_gen is @c heap_gen
+static __thread arena_t* thread_arena = NULL;
+static __thread unsigned thread_gen = 0;
+
+/// A list of cached blocks of one size
+typedef struct {
+  void* head;      ///< Most recently freed block
+  unsigned count;  ///< How many blocks in list
+} tcache_bin_t;
+
+/// Cache of current thread, valid if @c thread_gen is @c heap_gen
+static __thread tcache_bin_t tcache[TCACHE_BINS];
+/// Whether tcache of current thread is flushed on exit; later frees, from
+/// destructors of other thread-local data, would stay there and leak
+static __thread int tcache_off = 0;
+
+/// Recent requests of each block size of current thread, and their total
+static __thread unsigned short round_count[ROUND_BINS];
+static __thread unsigned round_clock;
+/// Recent requests of each block size extending heap while smaller free
+/// blocks are left, of current thread
+static __thread unsigned short round_starve[ROUND_BINS];
+/// Index of size each block size is rounded to, 0 if not rounded
+static __thread unsigned short round_to[ROUND_BINS];
+
+#ifndef DRIVER
+/// Flushes tcache when a thread exits
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+#endif
 
 // Helper function declarations
 
-static void* extend_heap(size_t);
-static void* coalesce(void*);
-static void* find_fit(size_t);
-static void place(void*, size_t);
+static void spin_lock(char*);
+static void spin_unlock(char*);
+static arena_t* get_arena(void);
+static arena_t* arena_of(const void*);
+
+static size_t usable_size(void*);
+static size_t size_round(size_t);
+static void size_round_update(void);
+static void size_starve(arena_t*, size_t);
+static int realloc_in_place(void*, size_t);
+static void* mmap_malloc(size_t, size_t);
+static void* mmap_realloc(void*, size_t);
+static void* arena_malloc(arena_t*, size_t, int, char**);
+static void* arena_malloc_aligned(arena_t*, size_t, size_t);
+static void arena_free(arena_t*, void*);
+static void block_free(arena_t*, void*);
+static void quick_flush(arena_t*);
+static void remote_free(arena_t*, void*);
+static void remote_drain(arena_t*);
+static void* tcache_fill(size_t);
+static void tcache_drain(tcache_bin_t*, unsigned);
+#ifndef DRIVER
+static void tcache_key_create(void);
+static void tcache_flush(void*);
+#endif
+#ifdef PRELOAD
+static void preload_init(void);
+static void preload_lock(void);
+static void preload_unlock(void);
+static void mem_init(void);
+static void* mem_sbrk(int);
+static void* mem_heap_lo(void);
+static void* mem_heap_hi(void);
+#endif
+
+static void* span_malloc(arena_t*, size_t, int);
+static void span_free(arena_t*, void*);
+static void span_link(arena_t*, span_t*);
+static void span_unlink(arena_t*, span_t*);
+
+static void purge_maybe(arena_t*, void*);
+static void purge_tree(char*, uint64_t);
+static void purge(void*);
+static uint64_t now_ms(void);
+
+static size_t grow_size(arena_t*, size_t);
+static void* extend_heap(arena_t*, size_t);
+static void* coalesce(arena_t*, void*);
+static void* find_fit(arena_t*, size_t);
+static void* find_fit_aligned(arena_t*, size_t, size_t, void**);
+static void* fit_aligned(char*, size_t, size_t);
+static void place(arena_t*, void*, size_t);
+static void place_aligned(arena_t*, void*, void*, size_t);
 
 void my_checkheap(const char*, int);
 
 static size_t seglist_get_index(size_t);
-static void seglist_insert(void*, size_t);
-static void seglist_remove(void*, size_t);
-static void* seglist_find(size_t, size_t);
+static void seglist_insert(arena_t*, void*, size_t);
+static void seglist_remove(arena_t*, void*, size_t);
+static size_t seglist_next(arena_t*, size_t);
+
+static int tree_less(const char*, const char*);
+static WORD tree_priority(const char*);
+static void tree_split(char*, const char*, char**, char**);
+static char* tree_merge(char*, char*);
+static char* tree_insert(char*, char*);
+static char* tree_remove(char*, char*);
+static char* tree_find(char*, size_t);
+static char* tree_find_aligned(char*, size_t, size_t, void**);
 
 /**
  * @brief Initialize dynamic allocator
@@ -198,23 +630,15 @@ static void* seglist_find(size_t, size_t);
  * @return -1 on error, 0 on success
  */
 int mm_init(void) {
-  if ((heap_begin = mem_sbrk(SEGLIST_SIZE * DWORD_SIZE + 4 * WORD_SIZE)) ==
-      ERRPTR)
-    return -1;
-  seglist = (void**)heap_begin;
-  for (int i = 0; i < SEGLIST_SIZE; i++) {
-    seglist[i] = NULL;
-  }
-  heap_begin = (char*)(seglist + SEGLIST_SIZE);
-  PUT_WORD(heap_begin, 0);  // Aligment padding
-  // prologue header
-  PUT_PACK(heap_begin + 1 * WORD_SIZE, DWORD_SIZE, BTAG_FREE, 1);
-  // prologue footer
-  PUT_PACK(heap_begin + 2 * WORD_SIZE, DWORD_SIZE, BTAG_FREE, 1);
-  // epilogue header
-  PUT_PACK(heap_begin + 3 * WORD_SIZE, 0, BTAG_ALLOC, 1);
-  heap_begin += DWORD_SIZE;
-  if (extend_heap(INIT_SIZE) == NULL) return -1;
+  memset(arenas, 0, sizeof(arenas));
+  memset(page_arena, 0, page_used);
+  memset(page_span, 0, page_used);
+  page_used = 0;
+  next_arena = 0;
+  heap_gen++;
+  // The first segment starts at the beginning of heap, owned by arena 0
+  heap_begin = (char*)mem_heap_lo() + DWORD_SIZE;
+  if (extend_heap(&arenas[0], INIT_SIZE) == NULL) return -1;
   CHECK_HEAP();
   return 0;
 }
@@ -227,37 +651,30 @@ int mm_init(void) {
  */
 void* malloc(size_t size) {
   size_t allocated_size;
+#ifdef PRELOAD
+  // Programs expect a unique pointer, as libc gives
+  if (size == 0) size = 1;
+#endif
   if (size == 0) return NULL;
-  /*
-   * What happens here is a special case dealing:
-   * In trace file `binary-bal.rep`, you may found
-   * that it allocate 448-byte-block and 64-byte-block
-   * alternately, which make my heap fragmented.
-   * Then, it free all 448-byte-block, then allocate
-   * 512-byte-block. This cause that those 448-byte-block
-   * not big enough, so our algorithm will try to extend
-   * heap. This cause very low space utilization.
-   * 
-   * Here's a workaround. When allocating 448-byte-block,
-   * just give it 512-byte-block. After that, all fllow-up
-   * allocation will be availble without extending heap.
-   */
-  if (size == 448) size = 512;
-  if (size <= MIN_PAYLOAD_SIZE)
-    allocated_size = MIN_BLOCK_SIZE;
+  if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+    return mmap_malloc(size, ALIGNMENT);
+  if (size <= SPAN_MAX_SIZE)
+    allocated_size = ALIGN(size);  // Object size in span, no header
   else
-    allocated_size = ALIGN(WORD_SIZE + size);
-  void* bp;
-  if ((bp = find_fit(allocated_size))) {
-    place(bp, allocated_size);
-    return bp;
-  }
-  size_t ext_size = MAX(allocated_size, CHUNK_SIZE);
-  if ((bp = extend_heap(ext_size / WORD_SIZE))) {
-    place(bp, allocated_size);
+    allocated_size = size_round(ALIGN(WORD_SIZE + size));
+  arena_t* a = get_arena();
+  if (TCACHE_COUNT && !tcache_off && allocated_size <= TCACHE_MAX_SIZE) {
+    tcache_bin_t* bin = &tcache[TCACHE_INDEX(allocated_size)];
+    void* bp = bin->head;
+    if (!bp) return tcache_fill(allocated_size);
+    bin->head = GET_NEXT_CACHED(bp);
+    bin->count--;
     return bp;
   }
-  return NULL;
+  spin_lock(&a->lock);
+  void* bp = arena_malloc(a, allocated_size, 1, NULL);
+  spin_unlock(&a->lock);
+  return bp;
 }
 
 /**
@@ -267,18 +684,44 @@ void* malloc(size_t size) {
  */
 void free(void* ptr) {
   if (!ptr) return;
-  size_t size = GET_SIZE(GET_HEADER(ptr));
-  PUT_PACK(GET_HEADER(ptr), size, BTAG_KEEP, 0);
-  PUT_PACK(GET_FOOTER(ptr), size, BTAG_KEEP, 0);
-  void* next_block = GET_NEXT_BLOCK(ptr);
-  PUT_FREE_BTAG(GET_HEADER(next_block));
-  coalesce(ptr);
+  if (IS_MAPPED(ptr)) {
+    size_t map_size = MAP_SIZE(ptr);
+    if (map_size > __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) &&
+        map_size <= MMAP_MAX_THRESHOLD) {
+      __atomic_store_n(&mmap_threshold, map_size, __ATOMIC_RELAXED);
+      __atomic_store_n(&trim_threshold, MAX(TRIM_THRESHOLD, 2 * map_size),
+                       __ATOMIC_RELAXED);
+    }
+    munmap(MAP_BASE(ptr), map_size);
+    return;
+  }
+  unsigned cls = page_span[PAGE_OF(ptr)];
+  size_t size = cls ? SPAN_CLASS_SIZE(cls) : GET_SIZE(GET_HEADER(ptr));
+  get_arena();  // Reset a stale tcache
+  if (TCACHE_COUNT && !tcache_off && size <= TCACHE_MAX_SIZE) {
+    tcache_bin_t* bin = &tcache[TCACHE_INDEX(size)];
+    if (bin->count == TCACHE_COUNT) tcache_drain(bin, TCACHE_BATCH);
+    SET_NEXT_CACHED(ptr, bin->head);
+    bin->head = ptr;
+    bin->count++;
+    return;
+  }
+  // Might be freed by another thread than the allocating one
+  arena_t* a = arena_of(ptr);
+  if (a != thread_arena) {
+    remote_free(a, ptr);
+    return;
+  }
+  spin_lock(&a->lock);
+  arena_free(a, ptr);
+  spin_unlock(&a->lock);
 }
 
 /**
  * @brief Re-allocation
  * Re-allocate the previously allocated block in @c oldptr ,
- * making the new block @c size bytes long.
+ * making the new block @c size bytes long. The block is resized in place
+ * if possible, otherwise moved. A mapped chunk staying large is remapped.
  * @param oldptr Pointer to previously allocated block
  * @param size New block size
  * @return Point to new allocated block
@@ -291,9 +734,17 @@ void* realloc(void* oldptr, size_t size) {
   if (oldptr == NULL) {
     return malloc(size);
   }
+  size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+  if (IS_MAPPED(oldptr)) {
+    if (size >= threshold) return mmap_realloc(oldptr, size);
+  } else if (page_span[PAGE_OF(oldptr)]) {
+    if (size <= usable_size(oldptr)) return oldptr;
+  } else if (size < threshold && realloc_in_place(oldptr, size)) {
+    return oldptr;
+  }
   void* newptr;
   if ((newptr = malloc(size)) == NULL) return NULL;
-  memcpy(newptr, oldptr, MIN(size, GET_SIZE(GET_HEADER(oldptr))));
+  memcpy(newptr, oldptr, MIN(size, usable_size(oldptr)));
   free(oldptr);
   return newptr;
 }
@@ -301,48 +752,793 @@ void* realloc(void* oldptr, size_t size) {
 /**
  * @brief Allocation with initialization
  * Allocate @c nmemb elements of @c size bytes each, all initialized to 0.
+ * Mapped chunks and purged pages are zero already, and left untouched.
  * @param nmemb Number of elements
  * @param size Size of each element
- * @return Pointer to first element allocated
+ * @return Pointer to first element allocated, @c NULL if the total size
+ * overflows
  */
 void* calloc(size_t nmemb, size_t size) {
+  if (nmemb && size > SIZE_MAX / nmemb) {
+    errno = ENOMEM;
+    return NULL;
+  }
   size_t total_size = size * nmemb;
-  void* bp = malloc(total_size);
+  if (total_size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+    return mmap_malloc(total_size, ALIGNMENT);
+  // Blocks in tcache or spans are small, simply clear them
+  if (total_size <= MAX(TCACHE_COUNT ? TCACHE_MAX_SIZE : 0, SPAN_MAX_SIZE)) {
+    void* bp = malloc(total_size);
+    if (bp) memset(bp, 0, total_size);
+    return bp;
+  }
+  arena_t* a = get_arena();
+  char* zero_end = NULL;
+  spin_lock(&a->lock);
+  char* bp = arena_malloc(a, ALIGN(WORD_SIZE + total_size), 1, &zero_end);
+  spin_unlock(&a->lock);
   if (!bp) return NULL;
-  memset(bp, 0, total_size);
+  char* end = bp + total_size;
+  char* zero_begin = PURGE_BEGIN(bp);
+  if (zero_begin >= MIN(zero_end, end)) {
+    memset(bp, 0, total_size);
+  } else {
+    memset(bp, 0, zero_begin - bp);
+    if (zero_end < end) memset(zero_end, 0, end - zero_end);
+  }
   return bp;
 }
 
+#ifndef DRIVER
+/**
+ * @brief Allocation with alignment
+ * Allocate @c size bytes, aligned to @c align bytes, without wasting space
+ * for alignment: small requests are rounded up to a span object size that
+ * is a multiple of @c align , as objects lie at multiples of their size
+ * past the span header; large ones are mapped with @c bp slid to the
+ * alignment; others are carved out of a free block, whose part before the
+ * aligned block stays free.
+ * @param align Alignment, a power of 2
+ * @param size Size of block
+ * @return Pointer to allocated memory, @c NULL on error
+ */
+void* memalign(size_t align, size_t size) {
+  if (align & (align - 1)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (align <= ALIGNMENT) return malloc(size);
+  // OFFSET of mapped chunks is a WORD, and size is rounded up to align
+  if (align > ((size_t)1 << 31) || size > SIZE_MAX / 2) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  size_t span_size = (MAX(size, 1) + align - 1) & ~(align - 1);
+  if (align <= sizeof(span_t) && span_size <= SPAN_MAX_SIZE)
+    return malloc(span_size);
+  if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) ||
+      align >= MMAP_THRESHOLD)
+    return mmap_malloc(size, align);
+  // Blocks of span sizes would be mistaken for span objects by tcache
+  size_t allocated_size = ALIGN(WORD_SIZE + MAX(size, SPAN_MAX_SIZE + 1));
+  arena_t* a = get_arena();
+  spin_lock(&a->lock);
+  void* bp = arena_malloc_aligned(a, allocated_size, align);
+  spin_unlock(&a->lock);
+  return bp;
+}
+
+/**
+ * @brief Allocation with alignment, POSIX version
+ *
+ * @param memptr Where to store pointer to allocated memory
+ * @param align Alignment, a power of 2 multiple of @c sizeof(void*)
+ * @param size Size of block
+ * @return 0 on success, @c EINVAL or @c ENOMEM on error
+ */
+int posix_memalign(void** memptr, size_t align, size_t size) {
+  if (align % sizeof(void*) || (align & (align - 1))) return EINVAL;
+  void* bp = memalign(align, size);
+  if (!bp && size) return ENOMEM;
+  *memptr = bp;
+  return 0;
+}
+
+/**
+ * @brief Allocation with alignment, C11 version
+ *
+ * @param align Alignment, a power of 2
+ * @param size Size of block
+ * @return Pointer to allocated memory, @c NULL on error
+ */
+void* aligned_alloc(size_t align, size_t size) {
+  return memalign(align, size);
+}
+
+/**
+ * @brief Allocation aligned to page
+ *
+ * @param size Size of block
+ * @return Pointer to allocated memory, @c NULL on error
+ */
+void* valloc(size_t size) { return memalign(PAGE_SIZE, size); }
+
+/**
+ * @brief Allocation aligned to page, rounded up to whole pages
+ *
+ * @param size Size of block
+ * @return Pointer to allocated memory, @c NULL on error
+ */
+void* pvalloc(size_t size) { return memalign(PAGE_SIZE, PAGE_ALIGN(size)); }
+
+/**
+ * @brief Get how many bytes can be used in a block
+ *
+ * @param ptr Pointer to allocated memory, or @c NULL
+ * @return Size of payload, 0 for @c NULL
+ */
+size_t malloc_usable_size(void* ptr) { return ptr ? usable_size(ptr) : 0; }
+#endif
+
 void mm_checkheap(int lineno) {}  // Shut up linker complaint.
 
 // Helper function definitions
 
 /**
- * @brief Extend heap with free blocks
+ * @brief Acquire a spin lock
+ *
+ * @param lock The lock
+ */
+static void spin_lock(char* lock) {
+  while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED)) sched_yield();
+}
+
+/**
+ * @brief Release a spin lock
+ *
+ * @param lock The lock
+ */
+static void spin_unlock(char* lock) { __atomic_clear(lock, __ATOMIC_RELEASE); }
+
+/**
+ * @brief Get the arena of current thread, assign one if not yet
+ * Also empties tcache left from before last @c mm_init .
+ * @return The arena
+ */
+static arena_t* get_arena(void) {
+  if (thread_gen != heap_gen) {
+#ifdef PRELOAD
+    preload_init();
+#endif
+    unsigned index = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+    thread_arena = &arenas[index % ARENA_NUM];
+    memset(tcache, 0, sizeof(tcache));
+    thread_gen = heap_gen;  // Before calls which may allocate
+#ifndef DRIVER
+    pthread_once(&tcache_key_once, tcache_key_create);
+    pthread_setspecific(tcache_key, thread_arena);
+#endif
+  }
+  return thread_arena;
+}
+
+/**
+ * @brief Get the arena owning a block
+ *
+ * @param bp The block
+ * @return The arena
+ */
+static arena_t* arena_of(const void* bp) {
+  size_t page = ((const char*)bp - (char*)mem_heap_lo()) >> PAGE_SHIFT;
+  return &arenas[page_arena[page]];
+}
+
+/**
+ * @brief Get how many bytes can be used in an allocated block
+ *
+ * @param bp The block
+ * @return Size of payload
+ */
+static size_t usable_size(void* bp) {
+  if (IS_MAPPED(bp)) return MAP_SIZE(bp) - MAP_OFFSET(bp);
+  unsigned cls = page_span[PAGE_OF(bp)];
+  return cls ? SPAN_CLASS_SIZE(cls) : GET_SIZE(GET_HEADER(bp)) - WORD_SIZE;
+}
+
+/**
+ * @brief Count a requested block size, and round it up, see above
+ *
+ * @param allocated_size Size of block requested
+ * @return Size of block to allocate
+ */
+static size_t size_round(size_t allocated_size) {
+  if (allocated_size > ROUND_MAX_SIZE) return allocated_size;
+  size_t i = ROUND_INDEX(allocated_size);
+  round_count[i]++;
+  if (++round_clock % ROUND_PERIOD == 0) size_round_update();
+  return round_to[i] ? (size_t)(round_to[i] + 1) * ALIGNMENT : allocated_size;
+}
+
+/**
+ * @brief Recompute @c round_to from @c round_count , see above
+ *
+ */
+static void size_round_update(void) {
+  if (round_clock % ROUND_DECAY == 0) {
+    for (size_t i = 0; i < ROUND_BINS; i++) {
+      round_count[i] /= 2;
+      round_starve[i] /= 2;
+    }
+  }
+  for (size_t i = 0; i < ROUND_BINS; i++) {
+    round_to[i] = 0;
+    if (!round_count[i]) continue;
+    size_t best = 0, limit = MIN(ROUND_INDEX(5 * (i + 1) / 4 * ALIGNMENT),
+                                 ROUND_BINS - 1);
+    for (size_t j = i + 1; j <= limit; j++) {
+      if (round_starve[j] * 16 >= round_count[j] &&
+          round_count[j] > round_count[best])
+        best = j;
+    }
+    if (best && round_count[best] * 4 >= round_count[i]) round_to[i] = best;
+  }
+}
+
+/**
+ * @brief Count a request extending heap, if free blocks at most a fifth
+ * smaller are left in seglists, which rounding would have made fit
+ * @param a The arena, whose lock is held
+ * @param size Size of block requested
+ */
+static void size_starve(arena_t* a, size_t size) {
+  if (size > ROUND_MAX_SIZE) return;
+  size_t index = seglist_get_index(size);
+  if (seglist_next(a, seglist_get_index(size - size / 5)) <= index)
+    round_starve[ROUND_INDEX(size)]++;
+}
+
+/**
+ * @brief Resize an allocated block (not in span) in place
+ * Shrink by splitting off the tail, or grow into the free block after it,
+ * extending heap first if the block is the last one. The tail is freed
+ * like any other block.
+ * @param bp The block
+ * @param size New payload size
+ * @return Whether resized
+ */
+static int realloc_in_place(void* bp, size_t size) {
+  // Blocks of span sizes would be mistaken for span objects by tcache
+  size_t new_size = ALIGN(WORD_SIZE + MAX(size, SPAN_MAX_SIZE + 1));
+  arena_t* a = arena_of(bp);
+  spin_lock(&a->lock);
+  size_t old_size = GET_SIZE(GET_HEADER(bp));
+  int grow = new_size > old_size;
+  if (grow) {
+    void* next = GET_NEXT_BLOCK(bp);
+    size_t avail = old_size;
+    if (!GET_ALLOC(GET_HEADER(next))) {
+      avail += GET_SIZE(GET_HEADER(next));
+      next = GET_NEXT_BLOCK(next);
+    }
+    // Followed by the epilogue at the break, so extension is adjacent
+    if (avail < new_size && next == a->seg_end &&
+        a->seg_end == (char*)mem_heap_hi() + 1) {
+      extend_heap(a, MAX(new_size - avail, MIN_BLOCK_SIZE) / WORD_SIZE);
+    }
+    next = GET_NEXT_BLOCK(bp);
+    size_t next_size = GET_SIZE(GET_HEADER(next));
+    if (GET_ALLOC(GET_HEADER(next)) || old_size + next_size < new_size) {
+      spin_unlock(&a->lock);
+      return 0;
+    }
+    seglist_remove(a, next, next_size);
+    old_size += next_size;
+    PUT_PACK(GET_HEADER(bp), old_size, BTAG_KEEP, 1);
+    PUT_ALLOC_BTAG(GET_HEADER(GET_NEXT_BLOCK(bp)));
+  }
+  if (old_size - new_size >= MIN_BLOCK_SIZE) {
+    PUT_PACK(GET_HEADER(bp), new_size, BTAG_KEEP, 1);
+    void* tail = GET_NEXT_BLOCK(bp);
+    PUT_PACK(GET_HEADER(tail), old_size - new_size, BTAG_ALLOC, 0);
+    PUT_PACK(GET_FOOTER(tail), old_size - new_size, BTAG_ALLOC, 0);
+    PUT_FREE_BTAG(GET_HEADER(GET_NEXT_BLOCK(tail)));
+    purge_maybe(a, coalesce(a, tail));
+  }
+  CHECK_HEAP();
+  spin_unlock(&a->lock);
+  return 1;
+}
+
+/**
+ * @brief Map a chunk for a large request
+ *
+ * @param size Payload size
+ * @param align Alignment of payload, a power of 2 not above 2^31
+ * @return Pointer to the chunk, @c NULL if mapping failed
+ */
+static void* mmap_malloc(size_t size, size_t align) {
+  // Mappings are aligned to page; a larger alignment needs room to slide
+  size_t head = align > PAGE_SIZE ? align : MAX(align, MAP_OVERHEAD);
+  if (size > SIZE_MAX - head - PAGE_SIZE) return NULL;
+  size_t map_size = PAGE_ALIGN(head + size);
+  char* base = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) return NULL;
+  char* bp = (char*)(((size_t)base + MAP_OVERHEAD + align - 1) & ~(align - 1));
+  MAP_SIZE(bp) = map_size;
+  MAP_OFFSET(bp) = bp - base;
+  PUT_WORD(GET_HEADER(bp), MAPPED | 1);
+  return bp;
+}
+
+/**
+ * @brief Resize a mapped chunk, moving pages instead of copying
+ *
+ * @param bp The chunk
+ * @param size New payload size
+ * @return Pointer to the chunk, @c NULL (chunk kept) if remapping failed
+ */
+static void* mmap_realloc(void* bp, size_t size) {
+  size_t offset = MAP_OFFSET(bp);
+  if (size > SIZE_MAX - offset - PAGE_SIZE) return NULL;
+  size_t map_size = PAGE_ALIGN(offset + size);
+  if (map_size == MAP_SIZE(bp)) return bp;
+  char* base = mremap(MAP_BASE(bp), MAP_SIZE(bp), map_size, MREMAP_MAYMOVE);
+  if (base == MAP_FAILED) return NULL;
+  bp = base + offset;
+  MAP_SIZE(bp) = map_size;
+  return bp;
+}
+
+/**
+ * @brief Allocate a block (or a span object) from arena
+ *
+ * @param a The arena, whose lock is held
+ * @param allocated_size Size of block, or object size if in span
+ * @param grow Whether to extend heap (or start a span) if needed
+ * @param zero_end If not @c NULL , where to store the end of pages known to
+ * be zero from @c PURGE_BEGIN of the block; not set for objects in span
+ * @return Pointer to the block, @c NULL if heap exhausted
+ */
+static void* arena_malloc(arena_t* a, size_t allocated_size, int grow,
+                          char** zero_end) {
+  remote_drain(a);
+  if (allocated_size <= SPAN_MAX_SIZE)
+    return span_malloc(a, allocated_size, grow);
+  void* bp;
+  if (allocated_size <= QUICK_MAX_SIZE &&
+      (bp = a->quick[QUICK_INDEX(allocated_size)])) {
+    a->quick[QUICK_INDEX(allocated_size)] = GET_NEXT_CACHED(bp);
+    a->quick_count--;
+    if (zero_end) *zero_end = bp;
+    return bp;
+  }
+  if (!(bp = find_fit(a, allocated_size)) && a->quick_count) {
+    quick_flush(a);
+    bp = find_fit(a, allocated_size);
+  }
+  if (!bp && grow) {
+    size_starve(a, allocated_size);
+    bp = extend_heap(a, grow_size(a, allocated_size) / WORD_SIZE);
+  }
+  if (!bp) return NULL;
+  if (zero_end)
+    *zero_end = GET_WORD(GET_HEADER(bp)) & PURGED ? PURGE_END(bp) : (char*)bp;
+  place(a, bp, allocated_size);
+  return bp;
+}
+
+/**
+ * @brief Allocate an aligned block from arena, extending heap if needed
  *
+ * @param a The arena, whose lock is held
+ * @param allocated_size Size of block
+ * @param align Alignment of block, a power of 2
+ * @return Pointer to the block, @c NULL if heap exhausted
+ */
+static void* arena_malloc_aligned(arena_t* a, size_t allocated_size,
+                                  size_t align) {
+  remote_drain(a);
+  void* bp;
+  void* fp = find_fit_aligned(a, allocated_size, align, &bp);
+  if (!fp && a->quick_count) {
+    quick_flush(a);
+    fp = find_fit_aligned(a, allocated_size, align, &bp);
+  }
+  size_t ext_size = grow_size(a, allocated_size + align + MIN_BLOCK_SIZE);
+  if (!fp && extend_heap(a, ext_size / WORD_SIZE))
+    fp = find_fit_aligned(a, allocated_size, align, &bp);
+  if (!fp) return NULL;
+  place_aligned(a, fp, bp, allocated_size);
+  return bp;
+}
+
+/**
+ * @brief Free a block into arena
+ * A small block is put into its quick list, see above.
+ * @param a The arena owning the block, whose lock is held
+ * @param ptr The block
+ */
+static void arena_free(arena_t* a, void* ptr) {
+  if (page_span[PAGE_OF(ptr)]) {
+    span_free(a, ptr);
+    return;
+  }
+  size_t size = GET_SIZE(GET_HEADER(ptr));
+  if (size <= QUICK_MAX_SIZE) {
+    if (a->quick_count == QUICK_LIMIT) quick_flush(a);
+    SET_NEXT_CACHED(ptr, a->quick[QUICK_INDEX(size)]);
+    a->quick[QUICK_INDEX(size)] = ptr;
+    a->quick_count++;
+    return;
+  }
+  block_free(a, ptr);
+}
+
+/**
+ * @brief Free a block (not in span) into seglists, coalescing it
+ *
+ * @param a The arena owning the block, whose lock is held
+ * @param ptr The block
+ */
+static void block_free(arena_t* a, void* ptr) {
+  size_t size = GET_SIZE(GET_HEADER(ptr));
+  PUT_PACK(GET_HEADER(ptr), size, BTAG_KEEP, 0);
+  PUT_PACK(GET_FOOTER(ptr), size, BTAG_KEEP, 0);
+  void* next_block = GET_NEXT_BLOCK(ptr);
+  PUT_FREE_BTAG(GET_HEADER(next_block));
+  purge_maybe(a, coalesce(a, ptr));
+}
+
+/**
+ * @brief Free all blocks in quick lists of arena, coalescing them
+ *
+ * @param a The arena, whose lock is held
+ */
+static void quick_flush(arena_t* a) {
+  for (int i = 0; i < QUICK_BINS; i++) {
+    void* bp;
+    while ((bp = a->quick[i])) {
+      a->quick[i] = GET_NEXT_CACHED(bp);
+      a->quick_count--;
+      block_free(a, bp);
+    }
+  }
+}
+
+/**
+ * @brief Free a block of another arena, without its lock
+ *
+ * @param a The arena owning the block
+ * @param bp The block
+ */
+static void remote_free(arena_t* a, void* bp) {
+  void* head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+  do {
+    SET_NEXT_CACHED(bp, head);
+  } while (!__atomic_compare_exchange_n(&a->remote, &head, bp, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Free all blocks in @c remote list of arena
+ *
+ * @param a The arena, whose lock is held
+ */
+static void remote_drain(arena_t* a) {
+  if (!__atomic_load_n(&a->remote, __ATOMIC_RELAXED)) return;
+  void* bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+  while (bp) {
+    void* next = GET_NEXT_CACHED(bp);
+    arena_free(a, bp);
+    bp = next;
+  }
+}
+
+/**
+ * @brief Allocate a block for empty tcache list
+ * Also puts @c TCACHE_BATCH - 1 more blocks of the same size into the list,
+ * as long as they fit without extending heap (or starting a span).
+ * @param allocated_size Size of block
+ * @return Pointer to the block, @c NULL if heap exhausted
+ */
+static void* tcache_fill(size_t allocated_size) {
+  arena_t* a = thread_arena;
+  tcache_bin_t* bin = &tcache[TCACHE_INDEX(allocated_size)];
+  spin_lock(&a->lock);
+  void* bp = arena_malloc(a, allocated_size, 1, NULL);
+  for (int i = 1; bp && i < TCACHE_BATCH; i++) {
+    void* fp = arena_malloc(a, allocated_size, 0, NULL);
+    if (!fp) break;
+    SET_NEXT_CACHED(fp, bin->head);
+    bin->head = fp;
+    bin->count++;
+  }
+  spin_unlock(&a->lock);
+  return bp;
+}
+
+/**
+ * @brief Free the @c n oldest blocks of a tcache list into their arenas
+ * Blocks of this thread's arena are freed under one lock; others go to
+ * @c remote lists of their arenas.
+ * @param bin The tcache list
+ * @param n How many blocks to drain
+ */
+static void tcache_drain(tcache_bin_t* bin, unsigned n) {
+  void** link = &bin->head;
+  for (unsigned i = n; i < bin->count; i++) link = (void**)*link;
+  void* bp = *link;
+  *link = NULL;
+  bin->count -= n;
+  arena_t* local = thread_arena;
+  int locked = 0;
+  while (bp) {
+    void* next = GET_NEXT_CACHED(bp);
+    arena_t* a = arena_of(bp);
+    if (a != local) {
+      remote_free(a, bp);
+    } else {
+      if (!locked) spin_lock(&local->lock);
+      locked = 1;
+      arena_free(local, bp);
+    }
+    bp = next;
+  }
+  if (locked) spin_unlock(&local->lock);
+}
+
+#ifndef DRIVER
+/**
+ * @brief Create @c tcache_key , only once
+ *
+ */
+static void tcache_key_create(void) {
+  pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/**
+ * @brief Free all blocks in tcache of an exiting thread, and turn it off
+ *
+ * @param arg Unused
+ */
+static void tcache_flush(void* arg) {
+  if (thread_gen != heap_gen) return;
+  for (int i = 0; i < TCACHE_BINS; i++)
+    tcache_drain(&tcache[i], tcache[i].count);
+  tcache_off = 1;
+}
+#endif
+
+/**
+ * @brief Allocate an object from a span
+ *
+ * @param a The arena, whose lock is held
+ * @param size Object size
+ * @param grow Whether to start a new span if no span has free objects
+ * @return Pointer to the object, @c NULL if heap exhausted
+ */
+static void* span_malloc(arena_t* a, size_t size, int grow) {
+  unsigned cls = size / ALIGNMENT;
+  span_t* s = a->spans[cls - 1];
+  if (!s) {
+    if (!grow || !(s = arena_malloc_aligned(a, SPAN_BLOCK_SIZE, PAGE_SIZE)))
+      return NULL;
+    page_span[PAGE_OF(s)] = cls;
+    s->free = 0;
+    s->bump = sizeof(span_t);
+    s->used = 0;
+    s->size = size;
+    span_link(a, s);
+  }
+  char* bp;
+  if (s->free) {
+    bp = (char*)s + s->free;
+    s->free = GET_WORD(bp);
+  } else {
+    bp = (char*)s + s->bump;
+    s->bump += size;
+  }
+  if (++s->used == SPAN_CAPACITY(size)) span_unlink(a, s);
+  return bp;
+}
+
+/**
+ * @brief Free an object into its span
+ *
+ * @param a The arena owning the span, whose lock is held
+ * @param bp The object
+ */
+static void span_free(arena_t* a, void* bp) {
+  span_t* s = SPAN_OF(bp);
+  if (s->used == SPAN_CAPACITY(s->size)) span_link(a, s);
+  PUT_WORD(bp, s->free);
+  s->free = (char*)bp - (char*)s;
+  if (--s->used) return;
+  if (a->spans[s->size / ALIGNMENT - 1] == s && !s->next) return;
+  span_unlink(a, s);
+  page_span[PAGE_OF(s)] = 0;
+  arena_free(a, s);
+}
+
+/**
+ * @brief Add a span to the list of its size
+ *
+ * @param a The arena owning the span
+ * @param s The span
+ */
+static void span_link(arena_t* a, span_t* s) {
+  span_t** head = &a->spans[s->size / ALIGNMENT - 1];
+  s->prev = NULL;
+  s->next = *head;
+  if (*head) (*head)->prev = s;
+  *head = s;
+}
+
+/**
+ * @brief Remove a span from the list of its size
+ *
+ * @param a The arena owning the span
+ * @param s The span
+ */
+static void span_unlink(arena_t* a, span_t* s) {
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    a->spans[s->size / ALIGNMENT - 1] = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+/**
+ * @brief Purge a just freed block if it is a large one at the break, or
+ * large free blocks of arena free for long enough if not purged lately
+ *
+ * @param a The arena owning the block, whose lock is held
+ * @param bp The free block
+ */
+static void purge_maybe(arena_t* a, void* bp) {
+  size_t size = GET_SIZE(GET_HEADER(bp));
+  if (size < PURGE_MIN_SIZE) return;
+  if (size >= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED) &&
+      GET_NEXT_BLOCK(bp) == a->seg_end &&
+      a->seg_end == (char*)mem_heap_hi() + 1) {
+    purge(bp);
+    return;
+  }
+  uint64_t now = now_ms();
+  if (now - a->purge_time < PURGE_DECAY) return;
+  a->purge_time = now;
+  purge_tree(a->tree, now);
+}
+
+/**
+ * @brief Purge large free blocks not purged yet in a treap, which have
+ * been free for @c PURGE_DECAY milliseconds
+ *
+ * @param bp The root
+ * @param now Current time, in ms
+ */
+static void purge_tree(char* bp, uint64_t now) {
+  while (bp) {
+    // Blocks in left subtree are smaller
+    if (GET_SIZE(GET_HEADER(bp)) >= PURGE_MIN_SIZE) {
+      purge_tree(GET_LEFT_CHILD(bp), now);
+      if (!(GET_WORD(GET_HEADER(bp)) & PURGED) &&
+          now - FREE_TIME(bp) >= PURGE_DECAY)
+        purge(bp);
+    }
+    bp = GET_RIGHT_CHILD(bp);
+  }
+}
+
+/**
+ * @brief Give pages inside a free block back to the system
+ *
+ * @param bp The free block
+ */
+static void purge(void* bp) {
+  char* begin = PURGE_BEGIN(bp);
+  char* end = PURGE_END(bp);
+  if (begin < end) madvise(begin, end - begin, MADV_DONTNEED);
+  GET_WORD(GET_HEADER(bp)) |= PURGED;
+}
+
+/**
+ * @brief Get current time of a coarse monotonic clock
+ *
+ * @return Time in ms
+ */
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Get how many bytes to extend heap by, see above
+ *
+ * @param a The arena to extend, whose lock is held
+ * @param size Bytes needed
+ * @return Bytes to extend
+ */
+static size_t grow_size(arena_t* a, size_t size) {
+  size_t grow = MAX(a->grow, CHUNK_SIZE);
+  a->grow = MIN(grow * 2, GROW_MAX_SIZE);
+  return MAX(size, grow);
+}
+
+/**
+ * @brief Extend heap with free blocks
+ * Extend the last segment of arena @c a , or start a new segment.
+ * @param a The arena to extend, whose lock is held
  * @param words How many @c WORD to extend
  * @return Pointer to free blocks
  */
-static void* extend_heap(size_t words) {
-  size_t ext_size = ((words % 2) ? (words + 1) : words) * WORD_SIZE;
+static void* extend_heap(arena_t* a, size_t words) {
+  size_t ext_size = ALIGN(words * WORD_SIZE);
   if (ext_size < MIN_BLOCK_SIZE) ext_size = MIN_BLOCK_SIZE;
   char* bp;
-  if ((bp = mem_sbrk(ext_size)) == ERRPTR) return NULL;
+  spin_lock(&sbrk_lock);
+  char* brk = (char*)mem_heap_hi() + 1;
+  if (a->seg_end != brk) {
+    // Start a new segment, with an epilogue for the extension to replace
+    size_t offset = brk - (char*)mem_heap_lo();
+    size_t pad = (PAGE_SIZE - offset % PAGE_SIZE) % PAGE_SIZE;
+    char* seg;
+    if ((seg = mem_sbrk(pad + SEGMENT_OVERHEAD)) == ERRPTR) {
+      spin_unlock(&sbrk_lock);
+      return NULL;
+    }
+    seg += pad;
+    PUT_WORD(seg, 0);  // Aligment padding
+    // prologue header
+    PUT_PACK(seg + 1 * WORD_SIZE, DWORD_SIZE, BTAG_FREE, 1);
+    // prologue footer
+    PUT_PACK(seg + 2 * WORD_SIZE, DWORD_SIZE, BTAG_FREE, 1);
+    // epilogue header
+    PUT_PACK(seg + 3 * WORD_SIZE, 0, BTAG_ALLOC, 1);
+    a->seg_end = seg + SEGMENT_OVERHEAD;
+  }
+#ifdef GROW_HUGE
+  size_t end = a->seg_end + ext_size - (char*)mem_heap_lo();
+  ext_size += (HUGE_PAGE_SIZE - end % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+#endif
+  if ((bp = mem_sbrk(ext_size)) == ERRPTR) {
+    spin_unlock(&sbrk_lock);
+    return NULL;
+  }
+  a->seg_end = bp + ext_size;
+  size_t last = PAGE_OF(a->seg_end - 1);
+  if (a != &arenas[0]) {
+    size_t first = PAGE_OF(a->seg_end - ext_size - SEGMENT_OVERHEAD);
+    memset(page_arena + first, a - arenas, last - first + 1);
+  }
+  page_used = MAX(page_used, last + 1);
+  spin_unlock(&sbrk_lock);
   PUT_PACK(GET_HEADER(bp), ext_size, BTAG_KEEP, 0);
   PUT_PACK(GET_FOOTER(bp), ext_size, GET_BTAG(GET_HEADER(bp)), 0);
   // epilogue header
   PUT_PACK(GET_HEADER(GET_NEXT_BLOCK(bp)), WORD_SIZE, BTAG_FREE, 1);
   PUT_FREE_BTAG(GET_HEADER(GET_NEXT_BLOCK(bp)));
-  return coalesce(bp);
+  void* fp = coalesce(a, bp);
+  // Fresh memory is zero, unless merged with a free block before it; the
+  // free time is not needed then, and may lie in its first page
+  if (HEAP_ZEROED && fp == bp) {
+    GET_WORD(GET_HEADER(bp)) |= PURGED;
+    if (ext_size >= PURGE_MIN_SIZE) FREE_TIME(bp) = 0;
+  }
+  return fp;
 }
 
 /**
  * @brief Merge two adjacent free blocks
  *
+ * @param a The arena owning the block
  * @param bp One of the block to be merged
  * @return Pointer to new merged block
  */
-static void* coalesce(void* bp) {
+static void* coalesce(arena_t* a, void* bp) {
   // WORD prev_alloc = GET_ALLOC(GET_FOOTER(GET_PREV_BLOCK(bp)));
   WORD prev_alloc = GET_BTAG(GET_HEADER(bp)) == BTAG_ALLOC;
   WORD next_alloc = GET_ALLOC(GET_HEADER(GET_NEXT_BLOCK(bp)));
@@ -352,13 +1548,13 @@ static void* coalesce(void* bp) {
   } else if (prev_alloc && !next_alloc) {
     size_t next_size = GET_SIZE(GET_HEADER(GET_NEXT_BLOCK(bp)));
     size += next_size;
-    seglist_remove(GET_NEXT_BLOCK(bp), next_size);
+    seglist_remove(a, GET_NEXT_BLOCK(bp), next_size);
     PUT_PACK(GET_HEADER(bp), size, BTAG_KEEP, 0);
     PUT_PACK(GET_FOOTER(bp), size, GET_BTAG(GET_HEADER(bp)), 0);
   } else if (!prev_alloc && next_alloc) {
     size_t prev_size = GET_SIZE(GET_HEADER(GET_PREV_BLOCK(bp)));
     size += prev_size;
-    seglist_remove(GET_PREV_BLOCK(bp), prev_size);
+    seglist_remove(a, GET_PREV_BLOCK(bp), prev_size);
     bp = GET_PREV_BLOCK(bp);
     PUT_PACK(GET_HEADER(bp), size, BTAG_KEEP, 0);
     PUT_PACK(GET_FOOTER(bp), size, GET_BTAG(GET_HEADER(bp)), 0);
@@ -366,13 +1562,13 @@ static void* coalesce(void* bp) {
     size_t next_size = GET_SIZE(GET_HEADER(GET_NEXT_BLOCK(bp)));
     size_t prev_size = GET_SIZE(GET_HEADER(GET_PREV_BLOCK(bp)));
     size += next_size + prev_size;
-    seglist_remove(GET_NEXT_BLOCK(bp), next_size);
-    seglist_remove(GET_PREV_BLOCK(bp), prev_size);
+    seglist_remove(a, GET_NEXT_BLOCK(bp), next_size);
+    seglist_remove(a, GET_PREV_BLOCK(bp), prev_size);
     bp = GET_PREV_BLOCK(bp);
     PUT_PACK(GET_HEADER(bp), size, BTAG_KEEP, 0);
     PUT_PACK(GET_FOOTER(bp), size, GET_BTAG(GET_HEADER(bp)), 0);
   }
-  seglist_insert(bp, size);
+  seglist_insert(a, bp, size);
   CHECK_HEAP();
   return bp;
 }
@@ -380,34 +1576,99 @@ static void* coalesce(void* bp) {
 /**
  * @brief Get an appropriate free block depends on @c size
  *
+ * @param a The arena to search
  * @param size The size of required block
  * @return Pointer to a fit block
  */
-static void* find_fit(size_t size) {
+static void* find_fit(arena_t* a, size_t size) {
   size_t index = seglist_get_index(size);
-  void* fp = NULL;
-  for (; index < SEGLIST_SIZE && (fp = seglist_find(index, size)) == NULL;
-       index++)
-    ;
-  return fp;
+  if (size < TREE_MIN_SIZE) {
+    void* fp = a->seglist[index];
+    if (fp && size <= GET_SIZE(GET_HEADER(fp))) return fp;
+    index = seglist_next(a, index + 1);
+    if (index < SEGLIST_SIZE) return a->seglist[index];
+  }
+  return tree_find(a->tree, size);
+}
+
+/**
+ * @brief Get a free block holding an aligned block of @c size
+ * Alignment is relative to @c mem_heap_lo , and there must be room for a
+ * free block before the aligned one, if any.
+ * @param a The arena to search
+ * @param size The size of required block
+ * @param align Alignment of @c bp , a power of 2
+ * @param bpp Where to store @c bp of the aligned block
+ * @return Pointer to a fit free block
+ */
+static void* find_fit_aligned(arena_t* a, size_t size, size_t align,
+                              void** bpp) {
+  // Any block in a class above that of this size fits, whatever its
+  // address; only heads of lower classes are tried
+  size_t sure = seglist_get_index(size + align + MIN_BLOCK_SIZE);
+  for (size_t i = seglist_next(a, seglist_get_index(size)); i < SEGLIST_SIZE;
+       i = seglist_next(a, i <= sure ? i + 1 : SEGLIST_SIZE)) {
+    char* fp = a->seglist[i];
+    if ((*bpp = fit_aligned(fp, size, align))) return fp;
+  }
+  return tree_find_aligned(a->tree, size, align, bpp);
+}
+
+/**
+ * @brief Find where an aligned block of @c size is in a free block
+ *
+ * @param fp The free block
+ * @param size The size of required block
+ * @param align Alignment of @c bp , a power of 2
+ * @return @c bp of the aligned block, @c NULL if it doesn't fit
+ */
+static void* fit_aligned(char* fp, size_t size, size_t align) {
+  char* base = mem_heap_lo();
+  char* bp = base + ((fp - base + align - 1) & ~(align - 1));
+  if (bp != fp && bp - fp < MIN_BLOCK_SIZE) bp += align;
+  return bp + size <= fp + GET_SIZE(GET_HEADER(fp)) ? bp : NULL;
+}
+
+/**
+ * @brief Place allocated block at @c bp inside a free block
+ * Split the part before @c bp as a free block
+ * @param a The arena owning the block
+ * @param fp The free block
+ * @param bp Where to place, found by @c find_fit_aligned
+ * @param alloc_size Allocated size
+ */
+static void place_aligned(arena_t* a, void* fp, void* bp, size_t alloc_size) {
+  size_t front = (char*)bp - (char*)fp;
+  if (front) {
+    size_t free_size = GET_SIZE(GET_HEADER(fp));
+    seglist_remove(a, fp, free_size);
+    PUT_PACK(GET_HEADER(fp), front, BTAG_KEEP, 0);
+    PUT_PACK(GET_FOOTER(fp), front, GET_BTAG(GET_HEADER(fp)), 0);
+    seglist_insert(a, fp, front);
+    PUT_PACK(GET_HEADER(bp), free_size - front, BTAG_FREE, 0);
+    PUT_PACK(GET_FOOTER(bp), free_size - front, BTAG_FREE, 0);
+    seglist_insert(a, bp, free_size - front);
+  }
+  place(a, bp, alloc_size);
 }
 
 /**
  * @brief Place allocated block inside a free block
  * Split a free block if available
+ * @param a The arena owning the block
  * @param ptr Where to place
  * @param alloc_size Allocated size
  */
-static void place(void* ptr, size_t alloc_size) {
+static void place(arena_t* a, void* ptr, size_t alloc_size) {
   size_t free_size = GET_SIZE(GET_HEADER(ptr));
-  seglist_remove(ptr, free_size);
+  seglist_remove(a, ptr, free_size);
   ptrdiff_t diff = free_size - alloc_size;
   if (diff >= MIN_BLOCK_SIZE) {
     PUT_PACK(GET_HEADER(ptr), alloc_size, BTAG_KEEP, 1);
     void* bp = GET_NEXT_BLOCK(ptr);
     PUT_PACK(GET_HEADER(bp), diff, BTAG_ALLOC, 0);
     PUT_PACK(GET_FOOTER(bp), diff, BTAG_ALLOC, 0);
-    seglist_insert(bp, diff);
+    seglist_insert(a, bp, diff);
   } else {
     PUT_PACK(GET_HEADER(ptr), free_size, BTAG_KEEP, 1);
     PUT_ALLOC_BTAG(GET_HEADER(GET_NEXT_BLOCK(ptr)));
@@ -424,75 +1685,57 @@ static void place(void* ptr, size_t alloc_size) {
  * @return index to seglist
  */
 static size_t seglist_get_index(size_t size) {
-  switch (size) {
-    case 0 ... 32:
-      return 0;
-    case 33 ... 64:
-      return 1;
-    case 65 ... 128:
-      return 2;
-    case 129 ... 256:
-      return 3;
-    case 257 ... 512:
-      return 4;
-    case 513 ... 1024:
-      return 5;
-    case 1025 ... 2048:
-      return 6;
-    case 2049 ... 4096:
-      return 7;
-    case 4097 ... 8192:
-      return 8;
-    case 8193 ... 16384:
-      return 9;
-    case 16385 ... 32768:
-      return 10;
-    case 32769 ... 65536:
-      return 11;
-    case 65537 ... 131072:
-      return 12;
-    case 131073 ... 262144:
-      return 13;
-    case 262145 ... 524288:
-      return 14;
-    case 524289 ... 1048576:
-      return 15;
-    default:
-      return 16;
-  }
+  if (size < MIN_BLOCK_SIZE) return 0;
+  unsigned log = 63 - __builtin_clzl(size);
+  return ((log - 4) << SEGLIST_SUB_BITS) |
+         ((size >> (log - SEGLIST_SUB_BITS)) &
+          ((1 << SEGLIST_SUB_BITS) - 1));
 }
 
 /**
  * @brief Insert a free block to seglist
  * Insert to the head of a list
+ * @param a The arena of seglist
  * @param fp Pointer to free block
  * @param size Free block size
  */
-static void seglist_insert(void* fp, size_t size) {
+static void seglist_insert(arena_t* a, void* fp, size_t size) {
+  if (size >= TREE_MIN_SIZE) {
+    if (size >= PURGE_MIN_SIZE) FREE_TIME(fp) = now_ms();
+    a->tree = tree_insert(a->tree, fp);
+    return;
+  }
   size_t index = seglist_get_index(size);
-  char* insert_pt = seglist[index];
+  char* insert_pt = a->seglist[index];
   if (insert_pt) {  // list not empty
     SET_PREV_FREE(insert_pt, fp);
   }
   SET_NEXT_FREE(fp, insert_pt);
   SET_PREV_FREE(fp, NULL);
-  seglist[index] = fp;
+  a->seglist[index] = fp;
+  a->seg_map[index / 64] |= (uint64_t)1 << (index % 64);
 }
 
 /**
  * @brief Remove a free block from seglist
  *
+ * @param a The arena of seglist
  * @param fp Pointer to free block
  * @param size Free block size
  */
-static void seglist_remove(void* fp, size_t size) {
+static void seglist_remove(arena_t* a, void* fp, size_t size) {
+  if (size >= TREE_MIN_SIZE) {
+    a->tree = tree_remove(a->tree, fp);
+    return;
+  }
   size_t index = seglist_get_index(size);
   char* next = GET_NEXT_FREE(fp);
   char* prev = GET_PREV_FREE(fp);
   if (prev) {
     SET_NEXT_FREE(prev, next);
   } else {
-    seglist[index] = next;
+    a->seglist[index] = next;
+    if (!next) a->seg_map[index / 64] &= ~((uint64_t)1 << (index % 64));
   }
   if (next) {
     SET_PREV_FREE(next, prev);
@@ -500,24 +1743,258 @@ static void seglist_remove(void* fp, size_t size) {
 }
 
 /**
- * @brief Find appropriate free block in seglist
- * The minimum block contains @c size bytes
- * @param index Index of seglist or @c SEGLIST_AUTO
+ * @brief Find the first non-empty seglist from @c index
+ *
+ * @param a The arena of seglist
+ * @param index Index of seglist to start with
+ * @return Index of non-empty seglist, @c SEGLIST_SIZE if not found
+ */
+static size_t seglist_next(arena_t* a, size_t index) {
+  for (size_t i = index / 64; i < SEGLIST_MAP_SIZE; i++) {
+    uint64_t map = a->seg_map[i];
+    if (i == index / 64) map &= ~(uint64_t)0 << (index % 64);
+    if (map) return i * 64 + __builtin_ctzll(map);
+  }
+  return SEGLIST_SIZE;
+}
+
+/**
+ * @brief Compare free blocks by (size, address)
+ *
+ * @return Whether @c x is less than @c y
+ */
+static int tree_less(const char* x, const char* y) {
+  size_t x_size = GET_SIZE(GET_HEADER(x));
+  size_t y_size = GET_SIZE(GET_HEADER(y));
+  return x_size < y_size || (x_size == y_size && x < y);
+}
+
+/**
+ * @brief Get treap priority of a free block, a hash of its address
+ *
+ */
+static WORD tree_priority(const char* bp) {
+  return (WORD)(bp - heap_begin) * 2654435761u;
+}
+
+/**
+ * @brief Split a treap into blocks less than @c key and the others
+ *
+ * @param t Root of treap
+ * @param key The block to split by
+ * @param l Where to store root of the less part
+ * @param r Where to store root of the other part
+ */
+static void tree_split(char* t, const char* key, char** l, char** r) {
+  char* child;
+  if (!t) {
+    *l = *r = NULL;
+  } else if (tree_less(t, key)) {
+    tree_split(GET_RIGHT_CHILD(t), key, &child, r);
+    SET_RIGHT_CHILD(t, child);
+    *l = t;
+  } else {
+    tree_split(GET_LEFT_CHILD(t), key, l, &child);
+    SET_LEFT_CHILD(t, child);
+    *r = t;
+  }
+}
+
+/**
+ * @brief Merge two treaps, all blocks of @c l less than those of @c r
+ *
+ * @return Root of merged treap
+ */
+static char* tree_merge(char* l, char* r) {
+  if (!l) return r;
+  if (!r) return l;
+  if (tree_priority(l) > tree_priority(r)) {
+    SET_RIGHT_CHILD(l, tree_merge(GET_RIGHT_CHILD(l), r));
+    return l;
+  }
+  SET_LEFT_CHILD(r, tree_merge(l, GET_LEFT_CHILD(r)));
+  return r;
+}
+
+/**
+ * @brief Insert a free block into treap
+ *
+ * @param t Root of treap
+ * @param bp The block
+ * @return New root of treap
+ */
+static char* tree_insert(char* t, char* bp) {
+  if (!t || tree_priority(bp) > tree_priority(t)) {
+    char *l, *r;
+    tree_split(t, bp, &l, &r);
+    SET_LEFT_CHILD(bp, l);
+    SET_RIGHT_CHILD(bp, r);
+    return bp;
+  }
+  if (tree_less(bp, t))
+    SET_LEFT_CHILD(t, tree_insert(GET_LEFT_CHILD(t), bp));
+  else
+    SET_RIGHT_CHILD(t, tree_insert(GET_RIGHT_CHILD(t), bp));
+  return t;
+}
+
+/**
+ * @brief Remove a free block from treap, whose size is not changed yet
+ *
+ * @param t Root of treap
+ * @param bp The block
+ * @return New root of treap
+ */
+static char* tree_remove(char* t, char* bp) {
+  if (t == bp) return tree_merge(GET_LEFT_CHILD(t), GET_RIGHT_CHILD(t));
+  if (tree_less(bp, t))
+    SET_LEFT_CHILD(t, tree_remove(GET_LEFT_CHILD(t), bp));
+  else
+    SET_RIGHT_CHILD(t, tree_remove(GET_RIGHT_CHILD(t), bp));
+  return t;
+}
+
+/**
+ * @brief Find the best fit block in treap
+ *
+ * @param t Root of treap
  * @param size Size of target
- * @return Pointer to the fit block, @c NULL if fit not fround
+ * @return The least block not smaller than @c size , @c NULL if not found
  */
-static void* seglist_find(size_t index, size_t size) {
-  if (index == SEGLIST_AUTO) index = seglist_get_index(size);
-  void* fp = seglist[index];
-  while (fp) {
-    if (size <= GET_SIZE(GET_HEADER(fp))) return fp;
-    fp = GET_NEXT_FREE(fp);
+static char* tree_find(char* t, size_t size) {
+  char* fit = NULL;
+  while (t) {
+    if (size <= GET_SIZE(GET_HEADER(t))) {
+      fit = t;
+      t = GET_LEFT_CHILD(t);
+    } else {
+      t = GET_RIGHT_CHILD(t);
+    }
   }
-  return NULL;
+  return fit;
+}
+
+/**
+ * @brief Find the least block in treap holding an aligned block of @c size
+ *
+ * @param t Root of treap
+ * @param size The size of required block
+ * @param align Alignment of @c bp , a power of 2
+ * @param bpp Where to store @c bp of the aligned block
+ * @return Pointer to a fit free block
+ */
+static char* tree_find_aligned(char* t, size_t size, size_t align,
+                               void** bpp) {
+  if (!t) return NULL;
+  if (size <= GET_SIZE(GET_HEADER(t))) {
+    char* fp = tree_find_aligned(GET_LEFT_CHILD(t), size, align, bpp);
+    if (fp) return fp;
+    if ((*bpp = fit_aligned(t, size, align))) return t;
+  }
+  return tree_find_aligned(GET_RIGHT_CHILD(t), size, align, bpp);
 }
 
 // End seglist helper functions
 
+#ifdef PRELOAD
+// Begin heap region functions, replacing memlib in shared library
+
+/// The heap region, and its break
+static char* mem_start = NULL;
+static char* mem_brk = NULL;
+
+/**
+ * @brief Make @c fork wait until no lock is held, so that the child never
+ * inherits a lock held by another thread
+ */
+__attribute__((constructor)) static void preload_atfork(void) {
+  pthread_atfork(preload_lock, preload_unlock, preload_unlock);
+}
+
+/**
+ * @brief Initialize the allocator on first use, only once
+ *
+ */
+static void preload_init(void) {
+  static char init_lock = 0;
+  static int initialized = 0;
+  if (__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) return;
+  spin_lock(&init_lock);
+  if (!initialized) {
+    mem_init();
+    if (mm_init() < 0) abort();
+    __atomic_store_n(&initialized, 1, __ATOMIC_RELEASE);
+  }
+  spin_unlock(&init_lock);
+}
+
+/**
+ * @brief Acquire all locks of the allocator, before @c fork
+ *
+ */
+static void preload_lock(void) {
+  for (int i = 0; i < ARENA_NUM; i++) spin_lock(&arenas[i].lock);
+  spin_lock(&sbrk_lock);
+}
+
+/**
+ * @brief Release all locks of the allocator, after @c fork
+ *
+ */
+static void preload_unlock(void) {
+  spin_unlock(&sbrk_lock);
+  for (int i = 0; i < ARENA_NUM; i++) spin_unlock(&arenas[i].lock);
+}
+
+/**
+ * @brief Reserve address space for heap
+ * The region is aligned to its size, so that alignments relative to
+ * @c mem_heap_lo are also absolute. Pages are backed when first touched.
+ */
+static void mem_init(void) {
+  char* p = mmap(NULL, 2 * MAX_HEAP_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) abort();
+  mem_start = (char*)(((size_t)p + MAX_HEAP_SIZE - 1) & ~(MAX_HEAP_SIZE - 1));
+  if (mem_start != p) munmap(p, mem_start - p);
+  munmap(mem_start + MAX_HEAP_SIZE, p + MAX_HEAP_SIZE - mem_start);
+#ifdef GROW_HUGE
+  madvise(mem_start, MAX_HEAP_SIZE, MADV_HUGEPAGE);
+#endif
+  mem_brk = mem_start;
+}
+
+/**
+ * @brief Extend heap, called with @c sbrk_lock held
+ *
+ * @param incr Bytes to extend, not negative
+ * @return Old break, @c ERRPTR if heap exhausted
+ */
+static void* mem_sbrk(int incr) {
+  if (incr < 0 || (size_t)(mem_brk - mem_start) + incr > MAX_HEAP_SIZE) {
+    errno = ENOMEM;
+    return ERRPTR;
+  }
+  char* old_brk = mem_brk;
+  mem_brk += incr;
+  return old_brk;
+}
+
+/**
+ * @brief Get the first byte of heap
+ *
+ */
+static void* mem_heap_lo(void) { return mem_start; }
+
+/**
+ * @brief Get the last byte of heap
+ *
+ */
+static void* mem_heap_hi(void) { return mem_brk - 1; }
+
+// End heap region functions
+#endif
+
 // Begin debug (Heap Checker) functions
 
 /**
@@ -538,9 +2015,36 @@ static int in_heap(const void* p) {
  */
 static int aligned(const void* p) { return (size_t)ALIGN(p) == (size_t)p; }
 
+/**
+ * @brief Check a treap of free blocks
+ *
+ * @param a The arena owning the treap
+ * @param t Root of treap
+ * @return Number of blocks, -1 if broken
+ */
+static long tree_check(arena_t* a, char* t) {
+  if (!t) return 0;
+  char* l = GET_LEFT_CHILD(t);
+  char* r = GET_RIGHT_CHILD(t);
+  if (!in_heap(t) || arena_of(t) != a || GET_ALLOC(GET_HEADER(t)) ||
+      GET_SIZE(GET_HEADER(t)) < TREE_MIN_SIZE) {
+    dbg_printf("Bad block %p in treap", t);
+    return -1;
+  }
+  if ((l && (!tree_less(l, t) || tree_priority(l) > tree_priority(t))) ||
+      (r && (!tree_less(t, r) || tree_priority(r) > tree_priority(t)))) {
+    dbg_printf("Treap order broken at %p", t);
+    return -1;
+  }
+  long nl = tree_check(a, l);
+  long nr = tree_check(a, r);
+  return nl < 0 || nr < 0 ? -1 : nl + nr + 1;
+}
+
 /**
  * @brief Heap consistency checker
  * Scans the heap and checks it for correctness, call it by @c CHECK_HEAP
+ * Only meaningful while no other thread is allocating.
  * **For Teacher Assistants / Instructors**
  *   I use this function instead of default @c mm_checkheap
  *   because I prefer passing @c __func__ than @c __LINE__ .
@@ -556,122 +2060,181 @@ void my_checkheap(const char* func, int lineno) {
   void* footer;
   void* heap_end = (char*)mem_heap_hi() + 1;
   void* prev;
-  if ((heap_begin - DWORD_SIZE - (char*)(mem_heap_lo())) !=
-      SEGLIST_SIZE * DWORD_SIZE) {
-    ch_printf("Seglist pointers don't have enough space.");
-  }
-  // Prologue checking
-  bp = heap_begin;
-  header = GET_HEADER(bp);
-  footer = GET_FOOTER(bp);
-  if (GET_SIZE(header) != DWORD_SIZE || GET_ALLOC(header) != 1) {
-    ch_printf("Prologue block smashed: wrong size (header)");
-    ch_printf("Prologue header: " PACK_FMT, PACK_ARG(header));
-    exit(EXIT_FAILURE);
-  }
-  if (GET_SIZE(footer) != DWORD_SIZE || GET_ALLOC(footer) != 1) {
-    ch_printf("Prologue block smashed: wrong size (footer)");
-    ch_printf("Prologue footer: " PACK_FMT, PACK_ARG(footer));
-    exit(EXIT_FAILURE);
-  }
-  // Epilogue checking
-  bp = heap_end;
-  header = GET_HEADER(bp);
-  footer = GET_FOOTER(bp);
-  if (GET_SIZE(header) != 0 || GET_ALLOC(header) != 1) {
-    ch_printf("Epilogue block smashed: wrong size");
-    ch_printf("Epilogue header: " PACK_FMT, PACK_ARG(header));
-    exit(EXIT_FAILURE);
-  }
-  // Alignment checking
-  for (bp = heap_begin; bp != heap_end; bp = GET_NEXT_BLOCK(bp)) {
-    if (!in_heap(bp)) {
-      ch_printf("Block %p not in heap (%p:%p): ", bp, mem_heap_hi(),
-                mem_heap_lo());
-      ch_printf("Header: " PACK_FMT, PACK_ARG(GET_HEADER(bp)));
+  if (heap_begin - DWORD_SIZE != (char*)mem_heap_lo()) {
+    ch_printf("First segment doesn't start at beginning of heap.");
+  }
+  // Walk every segment; the next one starts at the page after epilogue
+  for (char* seg = heap_begin - DWORD_SIZE; seg < (char*)heap_end;) {
+    // Prologue checking
+    bp = seg + DWORD_SIZE;
+    header = GET_HEADER(bp);
+    footer = GET_FOOTER(bp);
+    if (GET_SIZE(header) != DWORD_SIZE || GET_ALLOC(header) != 1) {
+      ch_printf("Prologue block smashed: wrong size (header)");
+      ch_printf("Prologue header: " PACK_FMT, PACK_ARG(header));
       exit(EXIT_FAILURE);
     }
-    if (!aligned(bp)) {
-      ch_printf("Block %p not aligned", bp);
-      ch_printf("Header: " PACK_FMT, PACK_ARG(GET_HEADER(bp)));
+    if (GET_SIZE(footer) != DWORD_SIZE || GET_ALLOC(footer) != 1) {
+      ch_printf("Prologue block smashed: wrong size (footer)");
+      ch_printf("Prologue footer: " PACK_FMT, PACK_ARG(footer));
       exit(EXIT_FAILURE);
     }
-  }
-  // H/F checking
-  prev = heap_begin;
-  for (bp = GET_NEXT_BLOCK(heap_begin); bp != heap_end;
-       prev = bp, bp = GET_NEXT_BLOCK(bp)) {
-    header = GET_HEADER(bp);
-    if (!GET_ALLOC(header)) {
-      // free block
-      footer = GET_FOOTER(bp);
-      if (GET_SIZE(header) != GET_SIZE(footer) ||
-          GET_ALLOC(header) != GET_ALLOC(footer) ||
-          GET_BTAG(header) != GET_BTAG(footer)) {
-        ch_printf("Block %p H/F mismatch:", bp);
+    arena_t* a = arena_of(bp);
+    for (prev = bp, bp = GET_NEXT_BLOCK(bp); GET_SIZE(GET_HEADER(bp));
+         prev = bp, bp = GET_NEXT_BLOCK(bp)) {
+      header = GET_HEADER(bp);
+      // Alignment checking
+      if (!in_heap(bp)) {
+        ch_printf("Block %p not in heap (%p:%p): ", bp, mem_heap_hi(),
+                  mem_heap_lo());
         ch_printf("Header: " PACK_FMT, PACK_ARG(header));
-        ch_printf("Footer: " PACK_FMT, PACK_ARG(footer));
+        exit(EXIT_FAILURE);
+      }
+      if (!aligned(bp)) {
+        ch_printf("Block %p not aligned", bp);
+        ch_printf("Header: " PACK_FMT, PACK_ARG(header));
+        exit(EXIT_FAILURE);
+      }
+      if (arena_of(bp) != a) {
+        ch_printf("Block %p not owned by arena of its segment", bp);
+        exit(EXIT_FAILURE);
+      }
+      // H/F checking
+      if (!GET_ALLOC(header)) {
+        // free block
+        footer = GET_FOOTER(bp);
+        if (GET_SIZE(header) != GET_SIZE(footer) ||
+            GET_ALLOC(header) != GET_ALLOC(footer) ||
+            GET_BTAG(header) != GET_BTAG(footer)) {
+          ch_printf("Block %p H/F mismatch:", bp);
+          ch_printf("Header: " PACK_FMT, PACK_ARG(header));
+          ch_printf("Footer: " PACK_FMT, PACK_ARG(footer));
+          exit(EXIT_FAILURE);
+        }
+        if (GET_NEXT_FREE(bp) && !in_heap(GET_NEXT_FREE(bp))) {
+          ch_printf("Free block %p 's next (%p) is not in heap.", bp,
+                    GET_NEXT_FREE(bp));
+          exit(EXIT_FAILURE);
+        }
+        if (GET_PREV_FREE(bp) && !in_heap(GET_PREV_FREE(bp))) {
+          ch_printf("Free block %p 's prev (%p) is not in heap.", bp,
+                    GET_PREV_FREE(bp));
+          exit(EXIT_FAILURE);
+        }
+      }
+      if (GET_ALLOC(header) && (GET_WORD(header) & PURGED)) {
+        ch_printf("Allocated block %p marked purged", bp);
+        exit(EXIT_FAILURE);
+      }
+      if (GET_SIZE(header) < MIN_BLOCK_SIZE) {
+        ch_printf("Block %p too small: ", bp);
+        ch_printf("Header: " PACK_FMT, PACK_ARG(header));
+        exit(EXIT_FAILURE);
+      }
+      if (!!GET_BTAG(header) != GET_ALLOC(GET_HEADER(prev))) {
+        ch_printf("BTAG of block %p doesn't match previous block ALLOC:", bp);
+        ch_printf("Current(%p) header: " PACK_FMT, bp, PACK_ARG(header));
+        ch_printf("Previous(%p) header: " PACK_FMT, prev,
+                  PACK_ARG(GET_HEADER(prev)));
+        exit(EXIT_FAILURE);
+      }
+      // Coalescing checking
+      if (!GET_ALLOC(GET_HEADER(prev)) && !GET_ALLOC(header)) {
+        ch_printf("Adjacent free block %p and %p", prev, bp);
+        ch_printf("%p header: " PACK_FMT, prev, PACK_ARG(GET_HEADER(prev)));
+        ch_printf("%p header: " PACK_FMT, bp, PACK_ARG(header));
         exit(EXIT_FAILURE);
       }
     }
-    if (GET_SIZE(header) < MIN_BLOCK_SIZE) {
-      ch_printf("Block %p too small: ", bp);
-      ch_printf("Header: " PACK_FMT, PACK_ARG(header));
-      exit(EXIT_FAILURE);
-    }
-    if (!!GET_BTAG(header) != GET_ALLOC(GET_HEADER(prev))) {
-      ch_printf("BTAG of block %p doesn't match previous block ALLOC:", bp);
-      ch_printf("Current(%p) header: " PACK_FMT, bp, PACK_ARG(GET_HEADER(bp)));
-      ch_printf("Previous(%p) header: " PACK_FMT, prev,
-                PACK_ARG(GET_HEADER(prev)));
-      exit(EXIT_FAILURE);
-    }
-  }
-  // Coalescing checking
-  prev = heap_begin;
-  for (bp = GET_NEXT_BLOCK(heap_begin); bp != heap_end;
-       prev = bp, bp = GET_NEXT_BLOCK(bp)) {
-    if (!GET_ALLOC(GET_HEADER(prev)) && !GET_ALLOC(GET_HEADER(bp))) {
-      ch_printf("Adjacent free block %p and %p", prev, bp);
-      ch_printf("%p header: " PACK_FMT, prev, PACK_ARG(GET_HEADER(prev)));
-      ch_printf("%p header: " PACK_FMT, bp, PACK_ARG(GET_HEADER(prev)));
+    // Epilogue checking
+    header = GET_HEADER(bp);
+    if (GET_ALLOC(header) != 1 || (char*)bp > (char*)heap_end) {
+      ch_printf("Epilogue block smashed: wrong size");
+      ch_printf("Epilogue header: " PACK_FMT, PACK_ARG(header));
       exit(EXIT_FAILURE);
     }
+    size_t offset = (char*)bp - (char*)mem_heap_lo();
+    seg = (char*)bp + (PAGE_SIZE - offset % PAGE_SIZE) % PAGE_SIZE;
   }
   // Seglist checking
-  for (int i = 0; i < SEGLIST_SIZE; i++) {
-    bp = seglist[i];
-    if (bp && !in_heap(bp)) {
-      ch_printf("seglist[%d] (%p) head not in heap.", i, bp);
-      exit(EXIT_FAILURE);
-    }
-  }
-  for (bp = heap_begin; bp != heap_end; bp = GET_NEXT_BLOCK(bp)) {
-    if (!GET_ALLOC(GET_HEADER(bp))) {
-      if (GET_NEXT_FREE(bp) && !in_heap(GET_NEXT_FREE(bp))) {
-        ch_printf("Free block %p 's next (%p) is not in heap.", bp,
-                  GET_NEXT_FREE(bp));
+  for (int k = 0; k < ARENA_NUM; k++) {
+    arena_t* a = &arenas[k];
+    for (int i = 0; i < SEGLIST_SIZE; i++) {
+      bp = a->seglist[i];
+      if (!bp != !(a->seg_map[i / 64] & ((uint64_t)1 << (i % 64)))) {
+        ch_printf("arena %d seglist[%d] doesn't match bitmap.", k, i);
         exit(EXIT_FAILURE);
       }
-      if (GET_PREV_FREE(bp) && !in_heap(GET_PREV_FREE(bp))) {
-        ch_printf("Free block %p 's prev (%p) is not in heap.", bp,
-                  GET_PREV_FREE(bp));
+      if (bp && !in_heap(bp)) {
+        ch_printf("arena %d seglist[%d] (%p) head not in heap.", k, i, bp);
         exit(EXIT_FAILURE);
       }
+      for (; bp; bp = GET_NEXT_FREE(bp)) {
+        if (arena_of(bp) != a) {
+          ch_printf("Free block %p in seglist of another arena %d", bp, k);
+          exit(EXIT_FAILURE);
+        }
+        if (GET_ALLOC(GET_HEADER(bp)) ||
+            seglist_get_index(GET_SIZE(GET_HEADER(bp))) != (size_t)i) {
+          ch_printf("Block %p in wrong seglist[%d]: " PACK_FMT, bp, i,
+                    PACK_ARG(GET_HEADER(bp)));
+          exit(EXIT_FAILURE);
+        }
+        void* next = GET_NEXT_FREE(bp);
+        if (next && GET_PREV_FREE(next) != bp) {
+          ch_printf("Mistaken linking between free blocks: ");
+          ch_printf("bp            : %p", next);
+          ch_printf("bp->prev      : %p", GET_PREV_FREE(next));
+          ch_printf("bp->prev->next: %p", bp);
+          exit(EXIT_FAILURE);
+        }
+      }
     }
-  }
-  for (int i = 0; i < SEGLIST_SIZE; i++) {
-    void* bp = seglist[i];
-    while (bp) {
-      bp = GET_NEXT_FREE(bp);
-      if (bp && GET_NEXT_FREE(GET_PREV_FREE(bp)) != bp) {
-        ch_printf("Mistaken linking between free blocks: ");
-        ch_printf("bp            : %p", bp);
-        ch_printf("bp->prev      : %p", GET_PREV_FREE(bp));
-        ch_printf("bp->prev->next: %p", GET_NEXT_FREE(GET_PREV_FREE(bp)));
+    for (bp = a->remote; bp; bp = GET_NEXT_CACHED(bp)) {
+      if (!in_heap(bp) || arena_of(bp) != a ||
+          (!page_span[PAGE_OF(bp)] && !GET_ALLOC(GET_HEADER(bp)))) {
+        ch_printf("Bad block %p in remote list of arena %d", bp, k);
         exit(EXIT_FAILURE);
       }
     }
+    unsigned quick_count = 0;
+    for (int i = 0; i < QUICK_BINS; i++) {
+      for (bp = a->quick[i]; bp; bp = GET_NEXT_CACHED(bp), quick_count++) {
+        if (!in_heap(bp) || arena_of(bp) != a || page_span[PAGE_OF(bp)] ||
+            !GET_ALLOC(GET_HEADER(bp)) ||
+            QUICK_INDEX(GET_SIZE(GET_HEADER(bp))) != (size_t)i) {
+          ch_printf("Bad block %p in quick list %d of arena %d", bp, i, k);
+          exit(EXIT_FAILURE);
+        }
+      }
+    }
+    if (quick_count != a->quick_count) {
+      ch_printf("Arena %d holds %u blocks in quick lists, but counts %u", k,
+                quick_count, a->quick_count);
+      exit(EXIT_FAILURE);
+    }
+    // Treap checking
+    if (tree_check(a, a->tree) < 0) {
+      ch_printf("Treap of arena %d broken", k);
+      exit(EXIT_FAILURE);
+    }
+    // Span checking
+    for (int i = 0; i < SPAN_CLASSES; i++) {
+      for (span_t* s = a->spans[i]; s; s = s->next) {
+        if (!in_heap(s) || arena_of(s) != a ||
+            page_span[PAGE_OF(s)] != i + 1 ||
+            s->size != (WORD)SPAN_CLASS_SIZE(i + 1) ||
+            s->used >= SPAN_CAPACITY(s->size) ||
+            !GET_ALLOC(GET_HEADER(s))) {
+          ch_printf("Bad span %p in list %d of arena %d", s, i, k);
+          exit(EXIT_FAILURE);
+        }
+        if (s->next && s->next->prev != s) {
+          ch_printf("Mistaken linking between spans %p and %p", s, s->next);
+          exit(EXIT_FAILURE);
+        }
+      }
+    }
   }
 #undef ch_printf
 }
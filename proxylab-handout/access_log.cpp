@@ -0,0 +1,305 @@
+/**
+ * @file access_log.cpp
+ * @author agent (agent@local)
+ * @brief The implementation of binary access log
+ * The log file and string table are handed out in segments of
+ * @c SEGMENT_SIZE bytes, each mapped into memory. A thread takes a segment
+ * and fills it without any locking; since threads here live for one
+ * connection, a thread returns its partially filled segment to
+ * @c free_segments on exit for the next thread.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#include "./access_log.h"
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./csapp2.h"
+
+/**
+ * @brief Map a whole file read-only
+ *
+ * @return (address, size); address is nullptr if file is empty
+ */
+static std::pair<const char*, std::size_t> map_file(const std::string& path) {
+  const int fd{csapp::Open(path.c_str(), O_RDONLY, 0)};
+  struct stat st;
+  csapp::Fstat(fd, &st);
+  const std::size_t size = st.st_size;
+  const char* addr{nullptr};
+  if (size) {
+    addr = static_cast<const char*>(
+        csapp::Mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+  }
+  csapp::Close(fd);
+  return {addr, size};
+}
+
+/**
+ * @brief Bytes of log file (or string table) mapped at once
+ *
+ */
+static constexpr const std::size_t SEGMENT_SIZE{1 << 16};
+
+/**
+ * @brief A mapped part of log file or string table
+ *
+ */
+struct Segment {
+  char* base{nullptr};      ///< Mapped address
+  std::uint64_t offset{0};  ///< Offset in file
+  std::size_t used{0};      ///< Bytes written
+};
+
+/**
+ * @brief A file handed out to threads in segments
+ *
+ */
+struct SegmentedFile {
+  int fd{-1};                          ///< Descriptor of the file
+  std::atomic<std::uint64_t> end{0};   ///< Offset of next unallocated segment
+  std::vector<Segment> free_segments;  ///< Released by exited threads
+  std::mutex mutex;                    ///< For free_segments and file size
+
+  /**
+   * @brief Open @c path ; old content is kept, new segments start after it
+   *
+   */
+  void open(const std::string& path) {
+    fd = csapp::Open(path.c_str(), O_RDWR | O_CREAT, csapp::DEF_MODE);
+    struct stat st;
+    csapp::Fstat(fd, &st);
+    end = (st.st_size + SEGMENT_SIZE - 1) / SEGMENT_SIZE * SEGMENT_SIZE;
+  }
+
+  /**
+   * @brief Map a new segment at the end of file
+   *
+   */
+  Segment new_segment() {
+    const std::uint64_t offset{end.fetch_add(SEGMENT_SIZE)};
+    {
+      // ftruncate never shrinks here, since segments are allocated in order
+      std::lock_guard lock(mutex);
+      struct stat st;
+      csapp::Fstat(fd, &st);
+      if (static_cast<std::uint64_t>(st.st_size) < offset + SEGMENT_SIZE &&
+          ftruncate(fd, offset + SEGMENT_SIZE) < 0)
+        csapp::unix_error("Ftruncate error");
+    }
+    return {static_cast<char*>(csapp::Mmap(nullptr, SEGMENT_SIZE,
+                                           PROT_READ | PROT_WRITE, MAP_SHARED,
+                                           fd, offset)),
+            offset, 0};
+  }
+};
+
+static SegmentedFile log_file;  ///< Array of AccessRecord
+static SegmentedFile str_file;  ///< String table
+
+/**
+ * @brief Segment of @c file owned by current thread
+ *
+ */
+struct ThreadSegment {
+  SegmentedFile& file;
+  Segment segment{};
+
+  explicit ThreadSegment(SegmentedFile& file) : file{file} {}
+  ThreadSegment(const ThreadSegment&) = delete;
+  ThreadSegment& operator=(const ThreadSegment&) = delete;
+
+  /**
+   * @brief Take @c size bytes (at most @c SEGMENT_SIZE ); they are in a new
+   * segment if current one has no room
+   *
+   * @return (address, offset in file)
+   */
+  std::pair<char*, std::uint64_t> reserve(std::size_t size) {
+    if (!segment.base) {
+      std::lock_guard lock(file.mutex);
+      if (!file.free_segments.empty()) {
+        segment = file.free_segments.back();
+        file.free_segments.pop_back();
+      }
+    }
+    // Rest of a full segment is left as zeros
+    if (segment.base && segment.used + size > SEGMENT_SIZE) {
+      csapp::Munmap(segment.base, SEGMENT_SIZE);
+      segment = {};
+    }
+    if (!segment.base) segment = file.new_segment();
+    const std::size_t at{std::exchange(segment.used, segment.used + size)};
+    return {segment.base + at, segment.offset + at};
+  }
+
+  ~ThreadSegment() {
+    if (!segment.base) return;
+    std::lock_guard lock(file.mutex);
+    file.free_segments.push_back(segment);
+  }
+};
+
+static thread_local ThreadSegment thread_records{log_file};
+static thread_local ThreadSegment thread_strings{str_file};
+
+/**
+ * @brief URI and its offset in string table of each string table entry (by
+ * hash), and the mutex for it
+ */
+static std::unordered_multimap<std::uint64_t,
+                               std::pair<std::string, std::uint64_t>>
+    str_offsets;
+static std::shared_mutex str_mutex;
+
+/**
+ * @brief 64-bit FNV-1a hash
+ *
+ */
+static std::uint64_t fnv1a(std::string_view s) {
+  std::uint64_t h{0xcbf29ce484222325ull};
+  for (unsigned char c : s) h = (h ^ c) * 0x100000001b3ull;
+  return h;
+}
+
+/**
+ * @brief Find @c uri in @c str_offsets , @c str_mutex must be held
+ *
+ */
+static std::optional<std::uint64_t> find_string(std::uint64_t hash,
+                                                std::string_view uri) {
+  auto [first, last] = str_offsets.equal_range(hash);
+  for (auto it = first; it != last; ++it)
+    if (it->second.first == uri) return it->second.second;
+  return std::nullopt;
+}
+
+/**
+ * @brief Get offset of @c uri in string table, appending it if new
+ * New entries are copied to this thread's mapped segment of string table,
+ * so no request makes a write(), and only the first request for a URI takes
+ * the exclusive lock. URIs that would not fit in a segment are cut.
+ */
+static std::uint64_t intern(std::uint64_t hash, std::string_view uri) {
+  if (uri.size() > SEGMENT_SIZE - sizeof(std::uint32_t)) {
+    uri = uri.substr(0, SEGMENT_SIZE - sizeof(std::uint32_t));
+    hash = fnv1a(uri);
+  }
+  {
+    std::shared_lock lock(str_mutex);
+    if (auto offset = find_string(hash, uri)) return *offset;
+  }
+  std::lock_guard lock(str_mutex);
+  if (auto offset = find_string(hash, uri)) return *offset;
+  const std::uint32_t len = uri.size();
+  // Padded to keep lengths aligned
+  const std::size_t size{(sizeof(len) + len + 3) & ~std::size_t{3}};
+  auto [entry, offset] = thread_strings.reserve(size);
+  memcpy(entry, &len, sizeof(len));
+  memcpy(entry + sizeof(len), uri.data(), len);
+  str_offsets.emplace(hash, std::pair{std::string(uri), offset});
+  return offset;
+}
+
+/**
+ * @brief Load entries of string table left by earlier runs into
+ * @c str_offsets , so that their URIs are not appended again
+ */
+static void load_strings(const std::string& path) {
+  const auto [strings, size] = map_file(path);
+  std::uint64_t offset{0};
+  std::uint32_t len;
+  while (offset + sizeof(len) <= size) {
+    memcpy(&len, strings + offset, sizeof(len));
+    // Zero length is unused space at end of a segment
+    if (!len) {
+      offset += sizeof(len);
+      continue;
+    }
+    if (offset + sizeof(len) + len > size) break;
+    std::string uri(strings + offset + sizeof(len), len);
+    const std::uint64_t hash{fnv1a(uri)};
+    if (!find_string(hash, uri))
+      str_offsets.emplace(hash, std::pair{std::move(uri), offset});
+    offset += (sizeof(len) + len + 3) & ~std::uint64_t{3};
+  }
+  if (strings) csapp::Munmap(const_cast<char*>(strings), size);
+}
+
+void access_log_open(const std::string& path) {
+  log_file.open(path);
+  str_file.open(path + ".str");
+  load_strings(path + ".str");
+}
+
+bool access_log_enabled() { return log_file.fd >= 0; }
+
+void access_log_write(AccessRecord record, std::string_view uri) {
+  if (!access_log_enabled()) return;
+  record.uri_hash = fnv1a(uri);
+  record.uri_offset = intern(record.uri_hash, uri);
+  memcpy(thread_records.reserve(sizeof(AccessRecord)).first, &record,
+         sizeof(AccessRecord));
+}
+
+AccessLogEntry::AccessLogEntry(int connfd,
+                               std::chrono::steady_clock::time_point start)
+    : start{start} {
+  record.timestamp_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count() -
+      elapsed_us();
+  sockaddr_storage addr;
+  socklen_t len{sizeof(addr)};
+  if (getpeername(connfd, reinterpret_cast<csapp::SA*>(&addr), &len) < 0)
+    return;
+  if (addr.ss_family == AF_INET) {
+    // Store as IPv4-mapped IPv6 address ::ffff:a.b.c.d
+    record.client[10] = record.client[11] = 0xff;
+    memcpy(record.client + 12,
+           &reinterpret_cast<const sockaddr_in&>(addr).sin_addr, 4);
+  } else if (addr.ss_family == AF_INET6) {
+    memcpy(record.client,
+           &reinterpret_cast<const sockaddr_in6&>(addr).sin6_addr, 16);
+  }
+}
+
+AccessLogEntry::~AccessLogEntry() {
+  if (!access_log_enabled()) return;
+  record.total_us = elapsed_us();
+  try {
+    access_log_write(record, uri);
+  } catch (const std::exception& e) {
+    // Logging should never break serving
+  }
+}
+
+AccessLogView::AccessLogView(const std::string& path) {
+  std::tie(log, log_size) = map_file(path);
+  std::tie(strings, strings_size) = map_file(path + ".str");
+}
+
+AccessLogView::~AccessLogView() {
+  if (log) csapp::Munmap(const_cast<char*>(log), log_size);
+  if (strings) csapp::Munmap(const_cast<char*>(strings), strings_size);
+}
+
+std::string AccessLogView::uri(std::uint64_t offset) const {
+  std::uint32_t len;
+  if (offset + sizeof(len) > strings_size) return "?";
+  memcpy(&len, strings + offset, sizeof(len));
+  if (offset + sizeof(len) + len > strings_size) return "?";
+  return std::string(strings + offset + sizeof(len), len);
+}
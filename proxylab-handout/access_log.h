@@ -0,0 +1,171 @@
+/**
+ * @file access_log.h
+ * @author agent (agent@local)
+ * @brief Compact binary access log
+ * The log file is an array of fixed-width @c AccessRecord ; URIs are
+ * stored once in a string table file ( @c "<log>.str" ), each as a 32-bit
+ * length followed by bytes and padded to 4 bytes, and referred to by
+ * offset. A zero length is unused space. Read it with @c logstat .
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief How the cache served a request
+ *
+ */
+enum class CacheResult : std::uint8_t {
+  None = 0,   ///< Not a cacheable request, or failed before lookup
+  Miss = 1,   ///< Fetched from origin
+  Hit = 2,    ///< Served from cache
+  Purge = 3,  ///< A PURGE request
+};
+
+/**
+ * @brief One request in access log
+ * Records whose @c timestamp_us is 0 are unused space and skipped.
+ */
+struct AccessRecord {
+  std::uint64_t timestamp_us;  ///< Accepting time, since Unix epoch
+  std::uint64_t uri_hash;      ///< FNV-1a hash of URI (cache key)
+  std::uint64_t uri_offset;    ///< Offset of URI in string table
+  std::uint64_t bytes;         ///< Bytes sent to client
+  std::uint8_t client[16];     ///< Client IPv6 address (IPv4-mapped)
+  std::uint16_t status;        ///< HTTP status code, 0 if none sent
+  CacheResult cache_result;    ///< How the cache served it
+  std::uint8_t reserved;       ///< Padding, always 0
+  std::uint32_t parse_us;      ///< Time to read and parse request line
+  std::uint32_t upstream_us;   ///< Time to first byte from origin
+  std::uint32_t total_us;      ///< Time to finish the request
+};
+
+static_assert(sizeof(AccessRecord) == 64, "AccessRecord must be 64 bytes");
+
+/**
+ * @brief Open (or append to) access log @c path and @c path.str
+ * Logging is disabled until this is called. URIs already in @c path.str
+ * are reused.
+ */
+void access_log_open(const std::string& path);
+
+/**
+ * @brief Whether access log is opened
+ *
+ */
+bool access_log_enabled();
+
+/**
+ * @brief Append a record; @c uri_hash and @c uri_offset are filled here
+ * Records go to a buffer mapped from the log file, owned by this thread
+ * (and passed on to later threads when it exits).
+ */
+void access_log_write(AccessRecord record, std::string_view uri);
+
+/**
+ * @brief The access record of one request, written on destruction
+ *
+ */
+class AccessLogEntry {
+ private:
+  std::chrono::steady_clock::time_point start;
+
+  std::uint32_t elapsed_us(std::chrono::steady_clock::time_point until =
+                               std::chrono::steady_clock::now()) const {
+    return static_cast<std::uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(until - start)
+            .count());
+  }
+
+ public:
+  AccessRecord record{};
+  std::string uri{};
+
+  /**
+   * @brief Start timing a request from client @c connfd
+   *
+   */
+  explicit AccessLogEntry(int connfd)
+      : AccessLogEntry(connfd, std::chrono::steady_clock::now()) {}
+
+  /**
+   * @brief Log a request from client @c connfd that began at @c start
+   * For requests whose entry can only be made once they are answered.
+   */
+  AccessLogEntry(int connfd, std::chrono::steady_clock::time_point start);
+  AccessLogEntry(const AccessLogEntry&) = delete;
+  AccessLogEntry& operator=(const AccessLogEntry&) = delete;
+  ~AccessLogEntry();
+
+  /**
+   * @brief Request line is parsed
+   *
+   */
+  void parsed() { record.parse_us = elapsed_us(); }
+
+  /**
+   * @brief Request line was parsed at @c at
+   *
+   */
+  void parsed(std::chrono::steady_clock::time_point at) {
+    record.parse_us = elapsed_us(at);
+  }
+
+  /**
+   * @brief First byte from origin arrived
+   *
+   */
+  void first_byte() {
+    if (!record.upstream_us) record.upstream_us = elapsed_us();
+  }
+};
+
+/**
+ * @brief Read-only view of an access log and its string table, for offline
+ * tools. Both files are mapped into memory.
+ */
+class AccessLogView {
+ private:
+  const char* log{nullptr};
+  std::size_t log_size{0};
+  const char* strings{nullptr};
+  std::size_t strings_size{0};
+
+ public:
+  explicit AccessLogView(const std::string& path);
+  AccessLogView(const AccessLogView&) = delete;
+  AccessLogView& operator=(const AccessLogView&) = delete;
+  ~AccessLogView();
+
+  /**
+   * @brief Number of record slots, including unused ones
+   *
+   */
+  std::size_t size() const { return log_size / sizeof(AccessRecord); }
+
+  /**
+   * @brief Get the @c i -th record slot
+   *
+   */
+  const AccessRecord& operator[](std::size_t i) const {
+    return reinterpret_cast<const AccessRecord*>(log)[i];
+  }
+
+  /**
+   * @brief Get URI at @c offset of string table, @c "?" if out of range
+   *
+   */
+  std::string uri(std::uint64_t offset) const;
+};
+
+#endif  // ACCESS_LOG_H
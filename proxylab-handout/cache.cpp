@@ -4,6 +4,10 @@
  * @brief The implementation of proxy cache
  * This cache use LRU eviction policy.
  * It use std::mutex for preventing simultaneous accessing.
+ * Blocks are located by a radix tree over URIs, which also makes purging
+ * by prefix cheap. ( @c index_mutex is always taken before block mutexes.)
+ * @c cache_visit bypasses both: it matches URI hashes kept in each block,
+ * and pins the block instead of locking it; writers wait for pins to drop.
  * ( @c std::mutex::lock & @c std::mutex::unlock is
  *   identical to @c csapp::P & @c csapp::V .)
  * @version 0.1
@@ -15,18 +19,30 @@
 
 #include "./cache.h"
 
+#include <atomic>
+#include <iostream>
+#include <shared_mutex>
+#include <thread>
+
+#include "./csapp2.h"
+#include "./radix_tree.h"
+
 /**
  * @brief The structure storing cache object
  *
  */
 struct CacheBlock {
-  CacheContent content{};             ///< An byte-array storing cache object
+  char* data{nullptr};                ///< Slot of this block in storage
+  std::size_t size{0};                ///< Size of cache object
   std::string uri{};                  ///< URI of this cache
-  int lru{0};                         ///< Last used time, updated after setting
+  mutable std::atomic_size_t lru{0};  ///< Last used time (get or set)
   bool is_empty{true};                ///< Whether this block is empty
   mutable int read_cnt{0};            ///< How many simutaneously reader threads
   mutable std::mutex cache_mutex;     ///< The mutex for the whole block
   mutable std::mutex read_cnt_mutex;  ///< The mutex for @c read_cnt
+  std::atomic_size_t key_hash{0};     ///< Hash of @c uri , 0 if empty
+  std::atomic_bool writing{false};    ///< Whether a writer is waiting or in
+  mutable std::atomic_int pins{0};    ///< How many @c cache_visit readers
 };
 
 /**
@@ -35,11 +51,30 @@ struct CacheBlock {
  */
 std::array<CacheBlock, CACHE_BLOCK_NUM> cache{};
 
+/**
+ * @brief Size of storage (all slots of @c cache )
+ *
+ */
+static constexpr const std::size_t STORAGE_SIZE{CACHE_BLOCK_NUM *
+                                                MAX_OBJECT_SIZE};
+
+/**
+ * @brief URI index of @c cache , mapping URI to the block storing it
+ *
+ */
+static RadixTree<CacheBlock*> cache_index;
+
+/**
+ * @brief The mutex for @c cache_index
+ *
+ */
+static std::shared_mutex index_mutex;
+
 /**
  * @brief Current time
  *
  */
-std::size_t current_lru{0};
+std::atomic_size_t current_lru{0};
 
 /**
  * @brief Things to do before reading cache
@@ -67,29 +102,81 @@ static void post_read(const CacheBlock& i) {
 
 /**
  * @brief Things to do before writing cache
- *
+ * Besides locking, turn away new @c cache_visit readers and wait for current
+ * ones, which never block.
  * @param i The cache to write
  */
-static void ante_write(CacheBlock& i) { i.cache_mutex.lock(); }
+static void ante_write(CacheBlock& i) {
+  i.cache_mutex.lock();
+  i.writing = true;
+  while (i.pins) std::this_thread::yield();
+}
 
 /**
  * @brief Things to do after writing cache
  *
  * @param i The cache to write
  */
-static void post_write(CacheBlock& i) { i.cache_mutex.unlock(); }
+static void post_write(CacheBlock& i) {
+  i.writing = false;
+  i.cache_mutex.unlock();
+}
+
+/**
+ * @brief Hash of URI stored in @c CacheBlock::key_hash , never 0
+ *
+ */
+static std::size_t uri_hash(std::string_view uri) {
+  return std::max<std::size_t>(std::hash<std::string_view>{}(uri), 1);
+}
+
+void cache_init(bool huge_pages) {
+  char* storage;
+  if (huge_pages) {
+    bool hugetlb;
+    storage = static_cast<char*>(csapp::Mmap_huge(STORAGE_SIZE, hugetlb));
+    std::clog << "Cache storage backed by "
+              << (hugetlb ? "huge pages" : "transparent huge pages (advised)")
+              << std::endl;
+  } else {
+    storage = static_cast<char*>(
+        csapp::Mmap(nullptr, STORAGE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  }
+  for (std::size_t i{0}; i < CACHE_BLOCK_NUM; ++i)
+    cache[i].data = storage + i * MAX_OBJECT_SIZE;
+}
 
 std::optional<const CacheContent> cache_get(const std::string& uri) {
-  for (const auto& i : cache) {
-    ante_read(i);
-    if (!i.is_empty && i.uri == uri) {
-      CacheContent content = i.content;
-      post_read(i);
-      return content;
+  std::shared_lock lock(index_mutex);
+  auto block = cache_index.find(uri);
+  if (!block.has_value()) return std::nullopt;
+  const CacheBlock& i = *block.value();
+  // Refreshed under shared lock, hence atomic
+  i.lru = current_lru++;
+  ante_read(i);
+  CacheContent content(i.data, i.data + i.size);
+  post_read(i);
+  return content;
+}
+
+bool cache_visit(std::string_view uri,
+                 const std::function<void(const char*, std::size_t)>& f) {
+  const std::size_t hash{uri_hash(uri)};
+  for (const CacheBlock& i : cache) {
+    if (i.key_hash != hash) continue;
+    // Pin before checking writing, so that a writer either sees the pin or
+    // is seen by us (both sequentially consistent)
+    i.pins++;
+    const bool hit{!i.writing && !i.is_empty && i.uri == uri};
+    if (hit) {
+      i.lru = current_lru++;
+      f(i.data, i.size);
     }
-    post_read(i);
+    i.pins--;
+    if (hit) return true;
   }
-  return std::nullopt;
+  return false;
 }
 
 static CacheBlock& cache_eviction() {
@@ -111,11 +198,52 @@ static CacheBlock& cache_eviction() {
 }
 
 void cache_set(const std::string& uri, const CacheContent& content) {
-  CacheBlock& target = cache_eviction();
+  if (content.size() > MAX_OBJECT_SIZE) return;
+  std::unique_lock lock(index_mutex);
+  // Overwrite the old copy if another thread has already cached it
+  auto block = cache_index.find(uri);
+  CacheBlock& target = block.has_value() ? *block.value() : cache_eviction();
   ante_write(target);
+  if (!target.is_empty) cache_index.erase(target.uri);
   target.uri = uri;
-  target.content = content;
+  std::copy(content.begin(), content.end(), target.data);
+  target.size = content.size();
   target.is_empty = false;
+  target.key_hash = uri_hash(uri);
   target.lru = current_lru++;
   post_write(target);
-}
\ No newline at end of file
+  cache_index.insert(uri, &target);
+}
+
+/**
+ * @brief Mark a block as empty
+ *
+ * @param i The cache to invalidate
+ */
+static void invalidate(CacheBlock& i) {
+  ante_write(i);
+  i.is_empty = true;
+  i.key_hash = 0;
+  i.uri.clear();
+  post_write(i);
+}
+
+std::size_t cache_purge(const std::string& uri) {
+  std::unique_lock lock(index_mutex);
+  auto block = cache_index.erase(uri);
+  if (!block.has_value()) return 0;
+  invalidate(*block.value());
+  return 1;
+}
+
+std::vector<std::string> cache_purge_prefix(const std::string& prefix) {
+  std::unique_lock lock(index_mutex);
+  auto removed = cache_index.erase_prefix(prefix);
+  std::vector<std::string> uris;
+  uris.reserve(removed.size());
+  for (auto& [uri, block] : removed) {
+    invalidate(*block);
+    uris.push_back(std::move(uri));
+  }
+  return uris;
+}
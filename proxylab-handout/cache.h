@@ -15,8 +15,12 @@
 #include <algorithm>
 #include <array>
 #include <cstdlib>
+#include <functional>
 #include <mutex>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 // Recommended max cache size
 // static constexpr const std::size_t MAX_CACHE_SIZE{1049000};
@@ -34,10 +38,20 @@ static constexpr const std::size_t MAX_OBJECT_SIZE{102400};
 static constexpr const std::size_t CACHE_BLOCK_NUM{10};
 
 /**
- * @brief Our caching object is a byte-array
+ * @brief Our caching object is a byte-array (at most @c MAX_OBJECT_SIZE )
  *
  */
-using CacheContent = std::array<char, MAX_OBJECT_SIZE>;
+using CacheContent = std::vector<char>;
+
+/**
+ * @brief Allocate storage of all cache blocks, call it before anything else
+ * Storage is one contiguous region of @c CACHE_BLOCK_NUM * @c MAX_OBJECT_SIZE
+ * bytes.
+ * @param huge_pages Back the storage with 2 MB huge pages (falls back to
+ * transparent huge pages, see @c csapp::Mmap_huge ), which saves TLB misses
+ * on the hit path
+ */
+void cache_init(bool huge_pages);
 
 /**
  * @brief Set content to cache
@@ -56,4 +70,32 @@ void cache_set(const std::string& uri, const CacheContent& content);
  */
 std::optional<const CacheContent> cache_get(const std::string& uri);
 
+/**
+ * @brief Look up cache without locking, for serving hits on the accepting
+ * thread
+ * The block is pinned while @c f runs, so @c f reads it in place; writers of
+ * this block wait meanwhile, hence @c f must not block.
+ * @param uri Which cache
+ * @param f Called with the content if cached
+ * @return Whether @c f is called; false also if the block is being written
+ */
+bool cache_visit(std::string_view uri,
+                 const std::function<void(const char*, std::size_t)>& f);
+
+/**
+ * @brief Invalidate the cache of exactly @c uri
+ *
+ * @param uri Which cache
+ * @return How many cache objects are purged (0 or 1)
+ */
+std::size_t cache_purge(const std::string& uri);
+
+/**
+ * @brief Invalidate all cache whose URI starts with @c prefix
+ * Only the matching entries of the URI index are visited.
+ * @param prefix URI prefix, e.g. @c "example.com:80/" for a whole host
+ * @return URIs of the purged cache objects
+ */
+std::vector<std::string> cache_purge_prefix(const std::string& prefix);
+
 #endif  // CACHE_H
\ No newline at end of file
@@ -0,0 +1,85 @@
+/**
+ * @file cachebench.cpp
+ * @author agent (agent@local)
+ * @brief Benchmark of cache hit throughput
+ * Fills every cache block, then reads random blocks from many threads.
+ * Compare @c "cachebench" with @c "cachebench -H" to see the effect of
+ * huge-page backed storage.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./cache.h"
+#include "./csapp2.h"
+
+int main(int argc, char** argv) {
+  bool huge_pages{false};
+  unsigned threads{std::max(1u, std::thread::hardware_concurrency())};
+  double seconds{2};
+  std::size_t object_size{MAX_OBJECT_SIZE};
+  for (int opt; (opt = getopt(argc, argv, "Ht:s:o:")) != -1;) {
+    switch (opt) {
+      case 'H':
+        huge_pages = true;
+        break;
+      case 't':
+        threads = std::stoul(optarg);
+        break;
+      case 's':
+        seconds = std::stod(optarg);
+        break;
+      case 'o':
+        object_size = std::min<std::size_t>(std::stoul(optarg),
+                                            MAX_OBJECT_SIZE);
+        break;
+      default:
+        std::cerr << "usage: " << argv[0]
+                  << " [-H] [-t <threads>] [-s <seconds>] [-o <object-size>]"
+                  << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  cache_init(huge_pages);
+  for (std::size_t i{0}; i < CACHE_BLOCK_NUM; ++i) {
+    cache_set("bench:80/" + std::to_string(i),
+              CacheContent(object_size, static_cast<char>(i)));
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<std::uint64_t> total_hits{0}, total_bytes{0};
+  std::vector<std::thread> workers;
+  for (unsigned t{0}; t < threads; ++t) {
+    workers.emplace_back([&, seed{t * 2654435761u + 1}]() mutable {
+      std::uint64_t hits{0}, bytes{0};
+      while (!stop.load(std::memory_order_relaxed)) {
+        // xorshift32
+        seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+        const auto content{
+            cache_get("bench:80/" + std::to_string(seed % CACHE_BLOCK_NUM))};
+        if (content.has_value()) ++hits, bytes += content.value().size();
+      }
+      total_hits += hits;
+      total_bytes += bytes;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto& i : workers) i.join();
+
+  std::cout << std::fixed << std::setprecision(2)
+            << (huge_pages ? "huge pages" : "normal pages") << ", " << threads
+            << " threads, " << object_size << "-byte objects: "
+            << total_hits / seconds << " hits/s, "
+            << total_bytes / seconds / (1 << 30) << " GiB/s" << std::endl;
+}
@@ -0,0 +1,234 @@
+/**
+ * @file cachesim.cpp
+ * @author agent (agent@local)
+ * @brief Replay access log to find hit ratio of every cache size
+ * The cache evicts the least recently used block, and LRU is a stack
+ * algorithm: an access hits in a cache of @c n blocks iff fewer than @c n
+ * other objects are used since its last access (its stack distance). So one
+ * pass computing stack distances gives hit ratio of all sizes at once.
+ * With @c -r , only objects whose URI hash falls in the sampled fraction are
+ * replayed, and distances are scaled up accordingly (SHARDS, Waldspurger et
+ * al., FAST '15); the estimate is good for large caches, but noisy for a
+ * few blocks, where hit ratio hinges on whether the hottest objects are
+ * sampled.
+ * PURGE records drop their object; the proxy logs a prefix PURGE as one
+ * record per purged object, so only objects cached then are dropped.
+ * The log is also replayed through @c cache.cpp itself at
+ * @c CACHE_BLOCK_NUM blocks as a cross-check.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./access_log.h"
+#include "./cache.h"
+#include "./csapp2.h"
+
+/**
+ * @brief Fenwick tree counting marked positions
+ *
+ */
+class Fenwick {
+ private:
+  std::vector<std::int64_t> tree;
+
+ public:
+  explicit Fenwick(std::size_t n) : tree(n + 1) {}
+  void add(std::size_t i, std::int64_t delta) {
+    for (++i; i < tree.size(); i += i & -i) tree[i] += delta;
+  }
+  /**
+   * @brief Sum of positions [0, i)
+   *
+   */
+  std::int64_t prefix(std::size_t i) const {
+    std::int64_t sum{0};
+    for (; i; i -= i & -i) sum += tree[i];
+    return sum;
+  }
+};
+
+/**
+ * @brief Hits and bytes of hits at each stack distance
+ *
+ */
+struct Histogram {
+  std::vector<std::uint64_t> hits{};
+  std::vector<std::uint64_t> bytes{};
+
+  void add(std::size_t distance, std::uint64_t size) {
+    if (distance >= hits.size()) {
+      hits.resize(distance + 1);
+      bytes.resize(distance + 1);
+    }
+    ++hits[distance];
+    bytes[distance] += size;
+  }
+};
+
+/**
+ * @brief Whether the proxy caches a response of @c size bytes
+ *
+ */
+static bool cacheable(std::uint64_t size) { return size <= MAX_OBJECT_SIZE; }
+
+/**
+ * @brief Replay through the real cache, @c cache_init must be called
+ *
+ * @return (hits, bytes of hits)
+ */
+static std::pair<std::uint64_t, std::uint64_t> replay_cache(
+    const AccessLogView& log) {
+  std::uint64_t hits{0}, hit_bytes{0};
+  for (std::size_t i{0}; i < log.size(); ++i) {
+    const AccessRecord& r{log[i]};
+    if (!r.timestamp_us) continue;
+    const std::string key{std::to_string(r.uri_hash)};
+    if (r.cache_result == CacheResult::Purge) {
+      cache_purge(key);
+    } else if (r.cache_result != CacheResult::None) {
+      if (cache_get(key).has_value()) {
+        ++hits, hit_bytes += r.bytes;
+      } else if (cacheable(r.bytes)) {
+        cache_set(key, CacheContent(r.bytes));
+      }
+    }
+  }
+  return {hits, hit_bytes};
+}
+
+int main(int argc, char** argv) {
+  double rate{1};
+  std::size_t step{0};
+  for (int opt; (opt = getopt(argc, argv, "r:s:")) != -1;) {
+    switch (opt) {
+      case 'r':
+        rate = std::clamp(std::stod(optarg), 1e-6, 1.0);
+        break;
+      case 's':
+        step = std::stoul(optarg);
+        break;
+      default:
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind != 1) {
+    std::cerr << "usage: " << argv[0]
+              << " [-r <sample-rate>] [-s <size-step>] <access-log>"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  try {
+    const AccessLogView log(argv[optind]);
+    // Sample by URI hash, so that all accesses of an object are either kept
+    // or dropped. FNV-1a of similar URIs are close, so mix it first
+    // (splitmix64 finalizer).
+    constexpr const std::uint64_t MODULUS{1 << 24};
+    const std::uint64_t threshold(rate * MODULUS);
+    auto sampled{[&](std::uint64_t hash) {
+      hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+      hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+      hash ^= hash >> 31;
+      return rate >= 1 || hash % MODULUS < threshold;
+    }};
+
+    std::uint64_t requests{0}, total_bytes{0};
+    Histogram histogram;
+    // Time of last access of each object; a position in this Fenwick tree
+    // is marked iff it is the last access of some object
+    std::unordered_map<std::uint64_t, std::size_t> last_access;
+    Fenwick marks(log.size());
+    std::size_t now{0};
+    for (std::size_t i{0}; i < log.size(); ++i) {
+      const AccessRecord& r{log[i]};
+      if (!r.timestamp_us || r.cache_result == CacheResult::None ||
+          !sampled(r.uri_hash))
+        continue;
+      auto it{last_access.find(r.uri_hash)};
+      if (r.cache_result == CacheResult::Purge) {
+        if (it != last_access.end()) {
+          marks.add(it->second, -1);
+          last_access.erase(it);
+        }
+        continue;
+      }
+      ++requests;
+      total_bytes += r.bytes;
+      // Uncacheable responses are never in cache, hence never evict others
+      if (!cacheable(r.bytes)) continue;
+      if (it != last_access.end()) {
+        const auto distance{marks.prefix(now) - marks.prefix(it->second + 1)};
+        histogram.add(distance / rate, r.bytes);
+        marks.add(it->second, -1);
+        it->second = now;
+      } else {
+        last_access.emplace(r.uri_hash, now);
+      }
+      marks.add(now++, 1);
+    }
+    if (!requests) {
+      std::cout << "No cacheable requests sampled" << std::endl;
+      return 0;
+    }
+
+    const std::size_t objects(last_access.size() / rate);
+    std::cout << "Requests: " << requests << ", objects: " << objects;
+    if (rate < 1) std::cout << " (estimated from " << rate * 100 << "%)";
+    std::cout << "\n\n"
+              << std::setw(8) << "Blocks" << std::setw(14) << "Budget"
+              << std::setw(12) << "Hit ratio" << std::setw(12) << "Byte ratio"
+              << '\n';
+    std::cout << std::fixed << std::setprecision(2);
+    // Sizes: every step, or powers of 2, up to all objects fit
+    std::vector<std::size_t> sizes;
+    for (std::size_t n{std::max<std::size_t>(step, 1)}; n < objects;
+         n = step ? n + step : n * 2)
+      sizes.push_back(n);
+    sizes.push_back(std::max<std::size_t>(objects, 1));
+    if (!std::count(sizes.begin(), sizes.end(), CACHE_BLOCK_NUM)) {
+      sizes.push_back(CACHE_BLOCK_NUM);
+      std::sort(sizes.begin(), sizes.end());
+    }
+    std::uint64_t hits{0}, hit_bytes{0};
+    std::size_t counted{0};
+    for (std::size_t n : sizes) {
+      // Hit in n blocks iff stack distance < n
+      for (; counted < std::min(n, histogram.hits.size()); ++counted) {
+        hits += histogram.hits[counted];
+        hit_bytes += histogram.bytes[counted];
+      }
+      std::cout << std::setw(8) << n << std::setw(14) << n * MAX_OBJECT_SIZE
+                << std::setw(11) << 100.0 * hits / requests << '%'
+                << std::setw(11)
+                << (total_bytes ? 100.0 * hit_bytes / total_bytes : 0.0)
+                << '%' << (n == CACHE_BLOCK_NUM ? "  <- current" : "")
+                << '\n';
+    }
+
+    cache_init(false);
+    const auto [real_hits, real_bytes]{replay_cache(log)};
+    std::uint64_t all_requests{0}, all_bytes{0};
+    for (std::size_t i{0}; i < log.size(); ++i) {
+      const AccessRecord& r{log[i]};
+      if (r.timestamp_us && r.cache_result != CacheResult::None &&
+          r.cache_result != CacheResult::Purge)
+        ++all_requests, all_bytes += r.bytes;
+    }
+    std::cout << "\ncache.cpp at " << CACHE_BLOCK_NUM << " blocks: "
+              << 100.0 * real_hits / all_requests << "% hit, "
+              << (all_bytes ? 100.0 * real_bytes / all_bytes : 0.0)
+              << "% byte hit" << std::endl;
+  } catch (const csapp::SystemException& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
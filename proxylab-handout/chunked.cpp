@@ -0,0 +1,99 @@
+/**
+ * @file chunked.cpp
+ * @author agent (agent@local)
+ * @brief The implementation of chunked decoder
+ * A byte-by-byte state machine, except that chunk data is copied in bulk.
+ * Bare LF is accepted as line terminator.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#include "./chunked.h"
+
+#include <algorithm>
+#include <limits>
+
+/**
+ * @brief Value of a hex digit, or -1 if @c c is not a hex digit
+ *
+ */
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+std::size_t ChunkedDecoder::feed(const char* data, std::size_t n,
+                                 std::vector<char>& out) {
+  std::size_t i{0};
+  while (i < n && state != State::Done) {
+    const char c{data[i]};
+    switch (state) {
+      case State::Size:
+        if (int v = hex_value(c); v >= 0) {
+          if (chunk_left > (std::numeric_limits<std::size_t>::max() >> 4))
+            throw ChunkedException("Chunk size overflow");
+          chunk_left = chunk_left << 4 | v;
+          has_digit = true;
+          i++;
+          break;
+        }
+        if (!has_digit) throw ChunkedException("Missing chunk size");
+        state = State::SizeExt;
+        [[fallthrough]];
+      case State::SizeExt:
+        i++;
+        if (c == '\n') {
+          has_digit = false;
+          state = chunk_left ? State::Data : State::TrailerStart;
+        }
+        break;
+      case State::Data: {
+        const std::size_t len{std::min(chunk_left, n - i)};
+        out.insert(out.end(), data + i, data + i + len);
+        total += len;
+        chunk_left -= len;
+        i += len;
+        if (!chunk_left) state = State::DataCR;
+        break;
+      }
+      case State::DataCR:
+        if (c == '\r') {
+          i++;
+          state = State::DataLF;
+          break;
+        }
+        [[fallthrough]];
+      case State::DataLF:
+        if (c != '\n') throw ChunkedException("Missing CRLF after chunk");
+        i++;
+        state = State::Size;
+        break;
+      case State::TrailerStart:
+        i++;
+        if (c == '\r')
+          state = State::TrailerLF;
+        else if (c == '\n')
+          state = State::Done;
+        else
+          state = State::Trailer;
+        break;
+      case State::Trailer:
+        i++;
+        if (c == '\n') state = State::TrailerStart;
+        break;
+      case State::TrailerLF:
+        if (c != '\n') throw ChunkedException("Missing CRLF after trailer");
+        i++;
+        state = State::Done;
+        break;
+      case State::Done:
+        break;
+    }
+  }
+  return i;
+}
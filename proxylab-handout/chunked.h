@@ -0,0 +1,75 @@
+/**
+ * @file chunked.h
+ * @author agent (agent@local)
+ * @brief Streaming decoder of HTTP/1.1 chunked transfer-coding
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef CHUNKED_H
+#define CHUNKED_H
+
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * @brief Thrown when the chunked stream is malformed
+ *
+ */
+class ChunkedException : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Decode a chunked message body (RFC 7230 4.1) incrementally
+ * Raw bytes can be fed in pieces of any size, e.g. as they arrive from
+ * the origin. Chunk extensions and trailer fields are discarded.
+ */
+class ChunkedDecoder {
+ private:
+  enum class State {
+    Size,          ///< Reading hex digits of chunk size
+    SizeExt,       ///< Skipping chunk extension till CRLF
+    Data,          ///< Reading chunk data
+    DataCR,        ///< Expecting CR after data
+    DataLF,        ///< Expecting LF after data
+    TrailerStart,  ///< At the beginning of a trailer line
+    Trailer,       ///< Skipping a trailer line
+    TrailerLF,     ///< Expecting LF of the final empty line
+    Done           ///< Whole body decoded
+  };
+  State state{State::Size};
+  std::size_t chunk_left{0};    ///< Bytes left in current chunk
+  bool has_digit{false};        ///< Whether size line has a digit yet
+  std::size_t total{0};         ///< Decoded size so far
+
+ public:
+  /**
+   * @brief Feed raw bytes into decoder
+   * Stops at the end of the body; bytes after it are not consumed.
+   * @param data Raw bytes of the message body
+   * @param n How many bytes
+   * @param out Decoded bytes are appended to it
+   * @return How many bytes of @c data are consumed
+   */
+  std::size_t feed(const char* data, std::size_t n, std::vector<char>& out);
+
+  /**
+   * @brief Whether the last chunk and trailer are fully decoded
+   *
+   */
+  bool done() const { return state == State::Done; }
+
+  /**
+   * @brief Size of the decoded body so far
+   *
+   */
+  std::size_t size() const { return total; }
+};
+
+#endif  // CHUNKED_H
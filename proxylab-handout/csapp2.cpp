@@ -13,6 +13,8 @@
 
 #include "./csapp2.h"
 
+#include <algorithm>
+
 namespace csapp {
 
 using namespace std::literals;
@@ -332,6 +334,26 @@ void Munmap(void* start, size_t length) {
   if (munmap(start, length) < 0) unix_error("munmap error");
 }
 
+void* Mmap_huge(size_t len, bool& hugetlb) {
+  len = (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void* ptr{mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)};
+  if ((hugetlb = ptr != MAP_FAILED)) return ptr;
+  // Over-map by one huge page, then trim both ends to align
+  char* raw{static_cast<char*>(Mmap(nullptr, len + HUGE_PAGE_SIZE,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  char* aligned{reinterpret_cast<char*>(
+      (reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE_SIZE - 1) &
+      ~(HUGE_PAGE_SIZE - 1))};
+  if (aligned != raw) Munmap(raw, aligned - raw);
+  if (aligned != raw + HUGE_PAGE_SIZE)
+    Munmap(aligned + len, raw + HUGE_PAGE_SIZE - aligned);
+  // Failure only means THP is disabled, normal pages still work
+  madvise(aligned, len, MADV_HUGEPAGE);
+  return aligned;
+}
+
 /***************************************************
  * Wrappers for dynamic storage allocation functions
  ***************************************************/
@@ -711,9 +733,9 @@ size_t Rio::readnb(char* s, size_t bytes) {
 }
 
 std::string Rio::readnb(size_t bytes) {
-  char usrbuf[MAXLINE];
-  readnb(usrbuf, bytes);
-  return std::string(usrbuf);
+  std::string usrbuf(bytes, '\0');
+  usrbuf.resize(readnb(usrbuf.data(), bytes));
+  return usrbuf;
 }
 
 size_t Rio::readlineb(char* s, size_t maxlen) {
@@ -724,14 +746,170 @@ size_t Rio::readlineb(char* s, size_t maxlen) {
 }
 
 std::string Rio::readlineb(size_t maxlen) {
-  char usrbuf[MAXLINE]{};
-  readlineb(usrbuf, maxlen);
-  return std::string(usrbuf);
+  std::string usrbuf(maxlen, '\0');
+  usrbuf.resize(readlineb(usrbuf.data(), maxlen));
+  return usrbuf;
+}
+
+/*******************************************
+ * Ring-buffer Rio, for zero-copy parsing
+ *******************************************/
+
+RingRio::RingRio(int fd, size_t capacity) : fd{fd}, capacity{1} {
+  while (this->capacity < capacity) this->capacity <<= 1;
+  buf = std::make_unique<char[]>(this->capacity);
+}
+
+/*
+ * fill - Read as much as free space allows, with one readv() over both
+ *     free segments of the ring. Returns bytes read, 0 on EOF.
+ */
+size_t RingRio::fill() {
+  if (eof || len == capacity) return 0;
+  size_t tail{(head + len) & (capacity - 1)};
+  struct iovec iov[2];
+  int iovcnt;
+  if (tail >= head) { /* Free: [tail, capacity) and [0, head) */
+    iov[0] = {buf.get() + tail, capacity - tail};
+    iov[1] = {buf.get(), head};
+    iovcnt = head ? 2 : 1;
+  } else { /* Free: [tail, head) */
+    iov[0] = {buf.get() + tail, head - tail};
+    iovcnt = 1;
+  }
+  ssize_t rc;
+  while ((rc = readv(fd, iov, iovcnt)) < 0) {
+    if (errno != EINTR) unix_error("RingRio readv error");
+  }
+  if (rc == 0) eof = true;
+  len += rc;
+  return rc;
+}
+
+/*
+ * grow - Enlarge buffer to hold at least min_capacity bytes, unwrapping
+ *     unread bytes to the beginning.
+ */
+void RingRio::grow(size_t min_capacity) {
+  size_t new_capacity{capacity};
+  while (new_capacity < min_capacity) new_capacity <<= 1;
+  if (new_capacity == capacity) return;
+  auto new_buf{std::make_unique<char[]>(new_capacity)};
+  size_t first{std::min(len, capacity - head)};
+  memcpy(new_buf.get(), buf.get() + head, first);
+  memcpy(new_buf.get() + first, buf.get(), len - first);
+  buf = std::move(new_buf);
+  capacity = new_capacity;
+  head = 0;
+}
+
+/*
+ * linearize - Make unread bytes contiguous (only needed if they wrap)
+ */
+void RingRio::linearize() {
+  if (head + len <= capacity) return;
+  std::rotate(buf.get(), buf.get() + head, buf.get() + capacity);
+  head = 0;
+}
+
+std::string_view RingRio::peek() {
+  if (len == 0) {
+    head = 0; /* Empty: restart from the beginning to avoid wrapping */
+    fill();
+  }
+  return {buf.get() + head, std::min(len, capacity - head)};
+}
+
+std::string_view RingRio::peek(size_t n) {
+  grow(n);
+  while (len < n && fill())
+    ;
+  n = std::min(n, len);
+  if (head + n > capacity) linearize();
+  return {buf.get() + head, n};
+}
+
+std::string_view RingRio::peekline(size_t maxlen) {
+  size_t scanned{0};
+  while (true) {
+    size_t limit{std::min(len, maxlen)};
+    for (; scanned < limit; scanned++) {
+      if (buf[(head + scanned) & (capacity - 1)] == '\n')
+        return peek(scanned + 1);
+    }
+    if (len >= maxlen) return peek(maxlen);
+    if (len == capacity) grow(capacity << 1);
+    if (!fill()) return peek(len); /* EOF, return the last partial line */
+  }
+}
+
+void RingRio::consume(size_t n) {
+  n = std::min(n, len);
+  head = (head + n) & (capacity - 1);
+  len -= n;
 }
 
 /********************************
  * Client/server helper functions
  ********************************/
+/*
+ * apply_profile - Set options of profile on sockfd, before connect() or
+ *     listen(). Failures are ignored, the socket works without them.
+ */
+static void apply_profile(int sockfd, const SocketProfile& profile,
+                          bool listening) {
+  auto set{[sockfd](int level, int optname, int optval) {
+    if (optval) setsockopt(sockfd, level, optname, &optval, sizeof(optval));
+  }};
+  set(IPPROTO_TCP, TCP_NODELAY, profile.nodelay);
+  set(SOL_SOCKET, SO_RCVBUF, profile.rcvbuf);
+  set(SOL_SOCKET, SO_SNDBUF, profile.sndbuf);
+  set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, profile.notsent_lowat);
+  if (listening) {
+    set(IPPROTO_TCP, TCP_DEFER_ACCEPT, profile.defer_accept);
+    set(IPPROTO_TCP, TCP_FASTOPEN, profile.fastopen);
+  } else {
+    /* SYN carries the first write if a TFO cookie is cached */
+    set(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, profile.fastopen != 0);
+  }
+}
+
+/*
+ * connect_timed - connect() that gives up after timeout ms, so that an
+ *     unreachable address does not hold the thread for the kernel's SYN
+ *     retry period. The socket is left blocking afterwards.
+ *
+ *     On error or timeout, returns -1 and sets errno.
+ */
+static int connect_timed(int sockfd, const SA* addr, socklen_t addrlen,
+                         int timeout) {
+  if (timeout <= 0) return connect(sockfd, addr, addrlen);
+  int flags{fcntl(sockfd, F_GETFL)};
+  if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+  int rc{connect(sockfd, addr, addrlen)};
+  if (rc < 0 && errno == EINPROGRESS) {
+    struct pollfd pfd{sockfd, POLLOUT, 0};
+    while ((rc = poll(&pfd, 1, timeout)) < 0 && errno == EINTR) {
+    }
+    if (rc == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if (rc < 0) return -1;
+    int err{0};
+    socklen_t len{sizeof(err)};
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) return -1;
+    if (err) {
+      errno = err;
+      return -1;
+    }
+    rc = 0;
+  }
+  if (rc < 0) return -1;
+  if (fcntl(sockfd, F_SETFL, flags) < 0) return -1;
+  return 0;
+}
+
 /*
  * open_clientfd - Open connection to server at <hostname, port> and
  *     return a socket descriptor ready for reading and writing. This
@@ -739,7 +917,8 @@ std::string Rio::readlineb(size_t maxlen) {
  *
  *     On error, returns -1 and sets errno.
  */
-int open_clientfd(const char* hostname, const char* port) {
+int open_clientfd(const char* hostname, const char* port,
+                  const SocketProfile& profile) {
   int clientfd;
   struct addrinfo hints;
   struct addrinfo* listp;
@@ -757,9 +936,12 @@ int open_clientfd(const char* hostname, const char* port) {
     /* Create a socket descriptor */
     if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
       continue; /* Socket failed, try the next */
+    apply_profile(clientfd, profile, false);
 
     /* Connect to the server */
-    if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) break; /* Success */
+    if (connect_timed(clientfd, p->ai_addr, p->ai_addrlen,
+                      profile.connect_timeout) != -1)
+      break; /* Success */
     Close(clientfd);
     /* Connect failed, try another */  // line:netp:openclientfd:closefd
   }
@@ -778,7 +960,7 @@ int open_clientfd(const char* hostname, const char* port) {
  *
  *     On error, returns -1 and sets errno.
  */
-int open_listenfd(const char* port) {
+int open_listenfd(const char* port, const SocketProfile& profile) {
   struct addrinfo hints;
   struct addrinfo* listp;
   struct addrinfo* p;
@@ -802,6 +984,7 @@ int open_listenfd(const char* port) {
     Setsockopt(listenfd, SOL_SOCKET,
                SO_REUSEADDR,  // line:netp:csapp:setsockopt
                (const void*)&optval, sizeof(int));
+    apply_profile(listenfd, profile, true);
     /* Bind the descriptor to the address */
     if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) break; /* Success */
     Close(listenfd); /* Bind failed, try the next */
@@ -813,7 +996,7 @@ int open_listenfd(const char* port) {
     return -1;
 
   /* Make it a listening socket ready to accept connection requests */
-  if (listen(listenfd, LISTENQ) < 0) {
+  if (listen(listenfd, profile.backlog) < 0) {
     Close(listenfd);
     return -1;
   }
@@ -823,18 +1006,20 @@ int open_listenfd(const char* port) {
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
-int Open_clientfd(const char* hostname, const char* port) {
+int Open_clientfd(const char* hostname, const char* port,
+                  const SocketProfile& profile) {
   int rc;
 
-  if ((rc = open_clientfd(hostname, port)) < 0)
+  if ((rc = open_clientfd(hostname, port, profile)) < 0)
     unix_error("Open_clientfd error");
   return rc;
 }
 
-int Open_listenfd(const char* port) {
+int Open_listenfd(const char* port, const SocketProfile& profile) {
   int rc;
 
-  if ((rc = open_listenfd(port)) < 0) unix_error("Open_listenfd error");
+  if ((rc = open_listenfd(port, profile)) < 0)
+    unix_error("Open_listenfd error");
   return rc;
 }
 
@@ -20,6 +20,8 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <setjmp.h>
@@ -29,6 +31,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -39,7 +42,9 @@
 #include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <tuple>
 
 namespace csapp {
@@ -64,6 +69,7 @@ extern char** environ; /* Defined by libc */
 constexpr const size_t MAXLINE{8192}; /* Max text line length */
 constexpr const size_t MAXBUF{8192};  /* Max I/O buffer size */
 constexpr const int LISTENQ{1024};    /* Second argument to listen() */
+constexpr const int CONNECT_TIMEOUT{3000}; /* connect() limit in ms */
 
 /* Our own error-handling functions */
 [[noreturn]] void unix_error(const char* msg);
@@ -126,6 +132,14 @@ int Closedir(DIR* dirp);
 void* Mmap(void* addr, size_t len, int prot, int flags, int fd, off_t offset);
 void Munmap(void* start, size_t length);
 
+/* Huge page (2 MB) backed anonymous memory
+ * Mmap_huge tries MAP_HUGETLB first; if no huge page is reserved, it falls
+ * back to normal pages aligned to HUGE_PAGE_SIZE and advised with
+ * MADV_HUGEPAGE, so that transparent huge pages can back them. hugetlb tells
+ * which one is used. Length is rounded up to HUGE_PAGE_SIZE. */
+constexpr const size_t HUGE_PAGE_SIZE{2 << 20};
+void* Mmap_huge(size_t len, bool& hugetlb);
+
 /* Standard I/O wrappers */
 void Fclose(FILE* fp);
 FILE* Fdopen(int fd, const char* type);
@@ -209,6 +223,57 @@ class Rio {
   std::string readlineb(size_t maxlen);
 };
 
+/**
+ * @brief Rio backed by a growable ring buffer, for parsing in place
+ * Instead of copying into user buffer, @c peek returns a view into the
+ * internal buffer, which stays valid until the next non-const call; then
+ * @c consume drops bytes that have been dealt with. Refilling reads into
+ * both free segments of the ring with one @c readv .
+ */
+class RingRio {
+ private:
+  int fd;
+  std::unique_ptr<char[]> buf;
+  size_t capacity;  ///< Buffer size, always a power of 2
+  size_t head{0};   ///< Index of first unread byte
+  size_t len{0};    ///< Unread bytes
+  bool eof{false};  ///< Whether EOF was read
+
+  size_t fill();
+  void grow(size_t min_capacity);
+  void linearize();
+
+ public:
+  RingRio(int fd, size_t capacity = RIO_BUFSIZE);
+  /**
+   * @brief View unread bytes that are contiguous in buffer
+   * Reads from @c fd only if nothing is buffered.
+   * @return Empty view on EOF
+   */
+  std::string_view peek();
+  /**
+   * @brief View the first @c n unread bytes (less only on EOF)
+   * Grows the buffer if @c n exceeds its capacity.
+   */
+  std::string_view peek(size_t n);
+  /**
+   * @brief View a text line (incl. @c '\n' ) of at most @c maxlen bytes
+   *
+   * @return Empty view on EOF
+   */
+  std::string_view peekline(size_t maxlen);
+  /**
+   * @brief Drop the first @c n unread bytes
+   *
+   */
+  void consume(size_t n);
+  /**
+   * @brief How many unread bytes are buffered
+   *
+   */
+  size_t size() const { return len; }
+};
+
 class SystemException : public std::exception {
  private:
   std::string msg;
@@ -250,13 +315,31 @@ class GaiException : public SystemException {
   }
 };
 
+/* Socket tuning applied by the client/server helpers below. Zero fields
+ * keep kernel defaults; options are best-effort (ignored if the kernel
+ * refuses them). On a listening socket, nodelay, buffer sizes and
+ * notsent_lowat are inherited by accepted sockets. */
+struct SocketProfile {
+  bool nodelay{false};    /* TCP_NODELAY: send small writes at once */
+  int defer_accept{0};    /* TCP_DEFER_ACCEPT: seconds to wait for data */
+  int fastopen{0};        /* TCP_FASTOPEN queue (listen), or
+                             TCP_FASTOPEN_CONNECT if nonzero (connect) */
+  int rcvbuf{0};          /* SO_RCVBUF bytes */
+  int sndbuf{0};          /* SO_SNDBUF bytes */
+  int notsent_lowat{0};   /* TCP_NOTSENT_LOWAT bytes */
+  int backlog{LISTENQ};   /* Second argument to listen() */
+  int connect_timeout{CONNECT_TIMEOUT}; /* connect() ms, 0 blocks */
+};
+
 /* Reentrant protocol-independent client/server helpers */
-int open_clientfd(const char* hostname, const char* port);
-int open_listenfd(const char* port);
+int open_clientfd(const char* hostname, const char* port,
+                  const SocketProfile& profile = {});
+int open_listenfd(const char* port, const SocketProfile& profile = {});
 
 /* Wrappers for reentrant protocol-independent client/server helpers */
-int Open_clientfd(const char* hostname, const char* port);
-int Open_listenfd(const char* port);
+int Open_clientfd(const char* hostname, const char* port,
+                  const SocketProfile& profile = {});
+int Open_listenfd(const char* port, const SocketProfile& profile = {});
 
 // Template function implementation
 
@@ -0,0 +1,609 @@
+/**
+ * @file h2.cpp
+ * @author agent (agent@local)
+ * @brief The implementation of HTTP/2 client (RFC 7540)
+ * Each connection has a reader thread, which decodes frames and dispatches
+ * them to streams; requesting threads wait on a condition variable. Frames
+ * are written under @c write_mutex , which also guards the HPACK encoder
+ * and stream id allocation (ids must go out in increasing order).
+ * ( @c write_mutex is always taken before @c mutex .)
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#include "./h2.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "./csapp2.h"
+
+namespace h2 {
+
+using namespace std::literals;
+
+namespace {
+
+/// Frame types
+enum FrameType : std::uint8_t {
+  DATA = 0x0,
+  HEADERS = 0x1,
+  PRIORITY = 0x2,
+  RST_STREAM = 0x3,
+  SETTINGS = 0x4,
+  PUSH_PROMISE = 0x5,
+  PING = 0x6,
+  GOAWAY = 0x7,
+  WINDOW_UPDATE = 0x8,
+  CONTINUATION = 0x9
+};
+
+/// Frame flags
+constexpr const std::uint8_t FLAG_END_STREAM{0x1};
+constexpr const std::uint8_t FLAG_ACK{0x1};
+constexpr const std::uint8_t FLAG_END_HEADERS{0x4};
+constexpr const std::uint8_t FLAG_PADDED{0x8};
+constexpr const std::uint8_t FLAG_PRIORITY{0x20};
+
+/// Settings identifiers
+constexpr const std::uint16_t SETTINGS_HEADER_TABLE_SIZE{0x1};
+constexpr const std::uint16_t SETTINGS_ENABLE_PUSH{0x2};
+constexpr const std::uint16_t SETTINGS_MAX_CONCURRENT_STREAMS{0x3};
+constexpr const std::uint16_t SETTINGS_INITIAL_WINDOW_SIZE{0x4};
+constexpr const std::uint16_t SETTINGS_MAX_FRAME_SIZE{0x5};
+
+/// Error code of RST_STREAM when we give up a stream
+constexpr const std::uint32_t ERROR_CANCEL{0x8};
+
+constexpr const std::string_view PREFACE{"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"};
+constexpr const std::size_t FRAME_HEADER_SIZE{9};
+/// Default SETTINGS_MAX_FRAME_SIZE, we never raise ours
+constexpr const std::size_t DEFAULT_FRAME_SIZE{16384};
+/// Default initial window size of both stream and connection
+constexpr const std::uint32_t DEFAULT_WINDOW{65535};
+
+/**
+ * @brief Receiving window of each stream (our SETTINGS_INITIAL_WINDOW_SIZE)
+ *
+ */
+constexpr const std::uint32_t STREAM_WINDOW{1 << 20};
+
+/**
+ * @brief Receiving window of the whole connection
+ *
+ */
+constexpr const std::uint32_t CONNECTION_WINDOW{16 << 20};
+
+std::uint32_t get_u32(const char* p) {
+  const auto* u = reinterpret_cast<const unsigned char*>(p);
+  return std::uint32_t{u[0]} << 24 | std::uint32_t{u[1]} << 16 |
+         std::uint32_t{u[2]} << 8 | u[3];
+}
+
+void put_u32(std::string& out, std::uint32_t v) {
+  out += static_cast<char>(v >> 24);
+  out += static_cast<char>(v >> 16);
+  out += static_cast<char>(v >> 8);
+  out += static_cast<char>(v);
+}
+
+}  // namespace
+
+/**
+ * @brief State of a stream, shared by @c Stream and @c Connection
+ * Protected by @c Connection::mutex .
+ */
+struct StreamState {
+  std::uint32_t id{0};
+  HeaderList headers{};                 ///< Final response header
+  bool has_headers{false};              ///< Whether @c headers arrived
+  std::deque<std::vector<char>> data{};  ///< Received but not read body
+  bool ended{false};                    ///< END_STREAM received
+  std::string error{};                  ///< Non-empty if stream failed
+  std::uint32_t unacked{0};  ///< Bytes read but not given back as window
+};
+
+/**
+ * @brief An HTTP/2 connection to an origin
+ *
+ */
+class Connection : public std::enable_shared_from_this<Connection> {
+ private:
+  const int fd;
+  csapp::Rio rio;
+  hpack::Decoder decoder{};  ///< Only used by reader thread
+
+  std::mutex write_mutex;
+  hpack::Encoder encoder{};
+  std::uint32_t next_stream_id{1};
+  std::size_t max_frame_size{DEFAULT_FRAME_SIZE};  ///< Peer's limit
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::unordered_map<std::uint32_t, std::shared_ptr<StreamState>> streams;
+  std::size_t opening{0};  ///< Streams waiting for an id
+  std::size_t max_streams{100};  ///< Peer's SETTINGS_MAX_CONCURRENT_STREAMS
+  bool dead{false};        ///< Connection failed or closed
+  bool going_away{false};  ///< No more new stream (GOAWAY received)
+  std::string error{};
+  std::uint32_t conn_unacked{0};  ///< Connection-level unacked bytes
+
+  /// Header block being received (HEADERS + CONTINUATION)
+  std::string header_block{};
+  std::uint32_t header_stream{0};
+  bool header_end_stream{false};
+
+  void write_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t id,
+                   std::string_view payload);
+  void read_loop();
+  void on_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t id,
+                std::string_view payload);
+  void on_header_block();
+  void on_settings(std::string_view payload);
+  void ack_connection();
+  void fail(const std::string& msg);
+
+ public:
+  explicit Connection(int fd) : fd{fd}, rio{fd} {}
+  ~Connection() { close(fd); }
+
+  void start();
+  bool usable() {
+    std::lock_guard lock(mutex);
+    return !dead && !going_away;
+  }
+  std::shared_ptr<StreamState> open(const HeaderList& headers);
+  const HeaderList& wait_headers(StreamState& st);
+  std::size_t read(StreamState& st, std::vector<char>& out);
+  void close_stream(StreamState& st);
+};
+
+/**
+ * @brief Write a frame, should hold @c write_mutex
+ *
+ */
+void Connection::write_frame(std::uint8_t type, std::uint8_t flags,
+                             std::uint32_t id, std::string_view payload) {
+  std::string frame;
+  frame.reserve(FRAME_HEADER_SIZE + payload.size());
+  frame += static_cast<char>(payload.size() >> 16);
+  frame += static_cast<char>(payload.size() >> 8);
+  frame += static_cast<char>(payload.size());
+  frame += static_cast<char>(type);
+  frame += static_cast<char>(flags);
+  put_u32(frame, id & 0x7fffffff);
+  frame += payload;
+  csapp::Rio::writen(fd, frame);
+}
+
+/**
+ * @brief Send preface and settings, then start reader thread
+ *
+ */
+void Connection::start() {
+  std::string settings;
+  for (auto [id, value] : {std::pair{SETTINGS_ENABLE_PUSH, 0u},
+                           std::pair{SETTINGS_INITIAL_WINDOW_SIZE,
+                                     STREAM_WINDOW}}) {
+    settings += static_cast<char>(id >> 8);
+    settings += static_cast<char>(id);
+    put_u32(settings, value);
+  }
+  std::string window;
+  put_u32(window, CONNECTION_WINDOW - DEFAULT_WINDOW);
+  {
+    std::lock_guard wlock(write_mutex);
+    csapp::Rio::writen(fd, PREFACE);
+    write_frame(SETTINGS, 0, 0, settings);
+    write_frame(WINDOW_UPDATE, 0, 0, window);
+  }
+  std::thread([self = shared_from_this()] { self->read_loop(); }).detach();
+}
+
+/**
+ * @brief Mark the connection dead and wake up every stream
+ *
+ */
+void Connection::fail(const std::string& msg) {
+  std::lock_guard lock(mutex);
+  if (dead) return;
+  std::clog << "HTTP/2 connection failed: " << msg << std::endl;
+  dead = true;
+  error = msg;
+  for (auto& [id, st] : streams) {
+    if (!st->ended && st->error.empty()) st->error = msg;
+  }
+  shutdown(fd, SHUT_RDWR);
+  cv.notify_all();
+}
+
+void Connection::read_loop() {
+  try {
+    std::array<char, FRAME_HEADER_SIZE> header;
+    std::string payload;
+    while (true) {
+      if (rio.readnb(header.data(), FRAME_HEADER_SIZE) != FRAME_HEADER_SIZE)
+        throw H2Exception("Connection closed by server");
+      const std::size_t length{get_u32(header.data()) >> 8};
+      const std::uint8_t type = header[3];
+      const std::uint8_t flags = header[4];
+      const std::uint32_t id{get_u32(header.data() + 5) & 0x7fffffff};
+      if (length > DEFAULT_FRAME_SIZE) throw H2Exception("Frame too large");
+      payload.resize(length);
+      if (rio.readnb(payload.data(), length) != length)
+        throw H2Exception("Connection closed by server");
+      on_frame(type, flags, id, payload);
+    }
+  } catch (const std::exception& e) {
+    fail(e.what());
+  }
+}
+
+void Connection::on_frame(std::uint8_t type, std::uint8_t flags,
+                          std::uint32_t id, std::string_view payload) {
+  if (header_stream && type != CONTINUATION)
+    throw H2Exception("Expect CONTINUATION frame");
+  // Strip padding (and priority fields) of DATA and HEADERS
+  std::size_t padding{0};
+  if ((type == DATA || type == HEADERS) && (flags & FLAG_PADDED)) {
+    if (payload.empty()) throw H2Exception("Bad padding");
+    padding = static_cast<std::uint8_t>(payload.front());
+    payload.remove_prefix(1);
+    if (padding > payload.size()) throw H2Exception("Bad padding");
+    payload.remove_suffix(padding);
+    padding++;
+  }
+  if (type == HEADERS && (flags & FLAG_PRIORITY)) {
+    if (payload.size() < 5) throw H2Exception("Bad priority");
+    payload.remove_prefix(5);
+  }
+  switch (type) {
+    case DATA: {
+      {
+        std::lock_guard lock(mutex);
+        auto it = streams.find(id);
+        if (it == streams.end()) {
+          // Stream already closed by us; still consumes connection window
+          conn_unacked += payload.size();
+        } else {
+          if (!payload.empty())
+            it->second->data.emplace_back(payload.begin(), payload.end());
+          if (flags & FLAG_END_STREAM) it->second->ended = true;
+        }
+        // Padding is never read by anyone, count it as consumed
+        conn_unacked += padding;
+        cv.notify_all();
+      }
+      // Nobody may read() again to give these bytes back
+      ack_connection();
+      break;
+    }
+    case HEADERS:
+      header_stream = id;
+      header_end_stream = flags & FLAG_END_STREAM;
+      header_block.assign(payload);
+      if (flags & FLAG_END_HEADERS) on_header_block();
+      break;
+    case CONTINUATION:
+      if (id != header_stream) throw H2Exception("Unexpected CONTINUATION");
+      header_block += payload;
+      if (flags & FLAG_END_HEADERS) on_header_block();
+      break;
+    case RST_STREAM: {
+      if (payload.size() != 4) throw H2Exception("Bad RST_STREAM");
+      std::lock_guard lock(mutex);
+      if (auto it = streams.find(id); it != streams.end()) {
+        it->second->error =
+            "Stream reset by server (code " +
+            std::to_string(get_u32(payload.data())) + ")";
+        cv.notify_all();
+      }
+      break;
+    }
+    case SETTINGS:
+      if (flags & FLAG_ACK) break;
+      on_settings(payload);
+      break;
+    case PING:
+      if (flags & FLAG_ACK) break;
+      {
+        std::lock_guard wlock(write_mutex);
+        write_frame(PING, FLAG_ACK, 0, payload);
+      }
+      break;
+    case GOAWAY: {
+      if (payload.size() < 8) throw H2Exception("Bad GOAWAY");
+      const std::uint32_t last_id{get_u32(payload.data()) & 0x7fffffff};
+      std::lock_guard lock(mutex);
+      going_away = true;
+      // Streams after last_id are not processed, can be retried elsewhere
+      for (auto& [sid, st] : streams) {
+        if (sid > last_id && st->error.empty())
+          st->error = "Connection going away";
+      }
+      cv.notify_all();
+      break;
+    }
+    case PUSH_PROMISE:
+      throw H2Exception("Push is disabled");
+    default:
+      // PRIORITY, WINDOW_UPDATE (we never send body) and unknown frames
+      break;
+  }
+}
+
+/**
+ * @brief A whole header block is received; decode it even if the stream is
+ * gone, so that HPACK state keeps in sync
+ */
+void Connection::on_header_block() {
+  HeaderList headers{decoder.decode(header_block)};
+  const std::uint32_t id{header_stream};
+  header_stream = 0;
+  header_block.clear();
+  std::lock_guard lock(mutex);
+  auto it = streams.find(id);
+  if (it == streams.end()) return;
+  StreamState& st = *it->second;
+  if (!st.has_headers) {
+    auto status = std::find_if(headers.begin(), headers.end(), [](auto& h) {
+      return h.first == ":status";
+    });
+    if (status == headers.end()) {
+      st.error = "Response without :status";
+    } else if (status->second.empty() || status->second.front() != '1') {
+      st.headers = std::move(headers);
+      st.has_headers = true;
+    }
+    // Interim (1xx) response is dropped
+  }
+  // Header block after body is trailer, ignored
+  if (header_end_stream) st.ended = true;
+  cv.notify_all();
+}
+
+void Connection::on_settings(std::string_view payload) {
+  if (payload.size() % 6) throw H2Exception("Bad SETTINGS");
+  std::lock_guard wlock(write_mutex);
+  for (; !payload.empty(); payload.remove_prefix(6)) {
+    const std::uint16_t id = static_cast<std::uint8_t>(payload[0]) << 8 |
+                             static_cast<std::uint8_t>(payload[1]);
+    const std::uint32_t value{get_u32(payload.data() + 2)};
+    switch (id) {
+      case SETTINGS_HEADER_TABLE_SIZE:
+        encoder.set_max_table_size(value);
+        break;
+      case SETTINGS_MAX_CONCURRENT_STREAMS: {
+        std::lock_guard lock(mutex);
+        max_streams = value;
+        cv.notify_all();
+        break;
+      }
+      case SETTINGS_MAX_FRAME_SIZE:
+        max_frame_size = value;
+        break;
+      default:
+        // Our requests have no body, peer's window does not matter
+        break;
+    }
+  }
+  write_frame(SETTINGS, FLAG_ACK, 0, ""sv);
+}
+
+/**
+ * @brief Give consumed bytes back as connection window, once there are
+ * enough of them
+ *
+ */
+void Connection::ack_connection() {
+  std::uint32_t update{0};
+  {
+    std::lock_guard lock(mutex);
+    if (conn_unacked < CONNECTION_WINDOW / 2) return;
+    update = std::exchange(conn_unacked, 0);
+  }
+  std::lock_guard wlock(write_mutex);
+  std::string payload;
+  put_u32(payload, update);
+  try {
+    write_frame(WINDOW_UPDATE, 0, 0, payload);
+  } catch (const csapp::SystemException& e) {
+    fail(e.what());
+  }
+}
+
+/**
+ * @brief Open a new stream and send request header on it
+ *
+ */
+std::shared_ptr<StreamState> Connection::open(const HeaderList& headers) {
+  {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [this] {
+      return dead || going_away || max_streams == 0 ||
+             streams.size() + opening < max_streams;
+    });
+    if (dead || going_away) throw H2Exception("Connection is closing");
+    // Waiting would never end, unless the server changes its mind
+    if (max_streams == 0) throw H2Exception("Server allows no stream");
+    opening++;
+  }
+  auto st = std::make_shared<StreamState>();
+  try {
+    std::lock_guard wlock(write_mutex);
+    {
+      std::lock_guard lock(mutex);
+      opening--;
+      if (dead) throw H2Exception("Connection is closed: " + error);
+      st->id = next_stream_id;
+      next_stream_id += 2;
+      // Stream id is running out, use a new connection next time
+      if (next_stream_id > 0x7fffffff) going_away = true;
+      streams.emplace(st->id, st);
+    }
+    std::string block;
+    encoder.encode(headers, block);
+    std::string_view rest{block};
+    std::uint8_t type{HEADERS};
+    do {
+      const std::string_view fragment{rest.substr(0, max_frame_size)};
+      rest.remove_prefix(fragment.size());
+      std::uint8_t flags = rest.empty() ? FLAG_END_HEADERS : 0;
+      if (type == HEADERS) flags |= FLAG_END_STREAM;
+      write_frame(type, flags, st->id, fragment);
+      type = CONTINUATION;
+    } while (!rest.empty());
+  } catch (const csapp::SystemException& e) {
+    fail(e.what());
+    throw;
+  }
+  return st;
+}
+
+const HeaderList& Connection::wait_headers(StreamState& st) {
+  std::unique_lock lock(mutex);
+  cv.wait(lock, [&st] {
+    return st.has_headers || st.ended || !st.error.empty();
+  });
+  if (!st.error.empty()) throw H2Exception(st.error);
+  if (!st.has_headers) throw H2Exception("Stream ended without response");
+  return st.headers;
+}
+
+std::size_t Connection::read(StreamState& st, std::vector<char>& out) {
+  std::uint32_t stream_update{0};
+  std::size_t n{0};
+  {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&st] {
+      return !st.data.empty() || st.ended || !st.error.empty();
+    });
+    if (st.data.empty()) {
+      if (!st.error.empty()) throw H2Exception(st.error);
+      return 0;
+    }
+    n = st.data.front().size();
+    out.insert(out.end(), st.data.front().begin(), st.data.front().end());
+    st.data.pop_front();
+    st.unacked += n;
+    conn_unacked += n;
+    // Give window back in batches
+    if (!st.ended && st.unacked >= STREAM_WINDOW / 2) {
+      stream_update = st.unacked;
+      st.unacked = 0;
+    }
+  }
+  if (stream_update) {
+    std::lock_guard wlock(write_mutex);
+    std::string payload;
+    put_u32(payload, stream_update);
+    try {
+      write_frame(WINDOW_UPDATE, 0, st.id, payload);
+    } catch (const csapp::SystemException& e) {
+      fail(e.what());
+    }
+  }
+  ack_connection();
+  return n;
+}
+
+/**
+ * @brief Forget the stream, reset it if not finished
+ *
+ */
+void Connection::close_stream(StreamState& st) {
+  bool reset{false};
+  {
+    std::lock_guard lock(mutex);
+    if (!streams.erase(st.id)) return;
+    for (const auto& i : st.data) conn_unacked += i.size();
+    st.data.clear();
+    reset = !st.ended && st.error.empty() && !dead;
+    cv.notify_all();
+  }
+  if (reset) {
+    std::lock_guard wlock(write_mutex);
+    std::string payload;
+    put_u32(payload, ERROR_CANCEL);
+    try {
+      write_frame(RST_STREAM, 0, st.id, payload);
+    } catch (const csapp::SystemException& e) {
+      fail(e.what());
+    }
+  }
+  ack_connection();
+}
+
+Stream::Stream(std::shared_ptr<Connection> conn,
+               std::shared_ptr<StreamState> state)
+    : conn{std::move(conn)}, state{std::move(state)} {}
+
+Stream::~Stream() { conn->close_stream(*state); }
+
+const HeaderList& Stream::response_headers() {
+  return conn->wait_headers(*state);
+}
+
+std::size_t Stream::read(std::vector<char>& out) {
+  return conn->read(*state, out);
+}
+
+/**
+ * @brief Connection (being) established to an origin
+ * @c mutex is held while connecting, so that concurrent requests to a new
+ * origin wait for one connection instead of each opening its own.
+ */
+struct PoolEntry {
+  std::mutex mutex;
+  std::shared_ptr<Connection> conn;
+};
+
+/**
+ * @brief Connections to all origins, keyed by @c "host:port"
+ *
+ */
+static std::unordered_map<std::string, std::shared_ptr<PoolEntry>> pool;
+
+/**
+ * @brief The mutex for @c pool
+ *
+ */
+static std::mutex pool_mutex;
+
+std::unique_ptr<Stream> request(const std::string& host, std::uint16_t port,
+                                const HeaderList& headers,
+                                const csapp::SocketProfile& profile) {
+  const std::string origin{host + ':' + std::to_string(port)};
+  std::shared_ptr<PoolEntry> entry;
+  {
+    std::lock_guard lock(pool_mutex);
+    auto& i = pool[origin];
+    if (!i) i = std::make_shared<PoolEntry>();
+    entry = i;
+  }
+  std::shared_ptr<Connection> conn;
+  {
+    std::lock_guard lock(entry->mutex);
+    if (!entry->conn || !entry->conn->usable()) {
+      std::clog << "Opening HTTP/2 connection to " << origin << std::endl;
+      entry->conn = std::make_shared<Connection>(
+          csapp::Open_clientfd(host.c_str(), std::to_string(port).c_str(),
+                               profile));
+      entry->conn->start();
+    }
+    conn = entry->conn;
+  }
+  return std::make_unique<Stream>(conn, conn->open(headers));
+}
+
+}  // namespace h2
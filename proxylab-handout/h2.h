@@ -0,0 +1,87 @@
+/**
+ * @file h2.h
+ * @author agent (agent@local)
+ * @brief A minimal HTTP/2 client over cleartext (h2c, prior knowledge)
+ * All requests to the same origin are multiplexed over one shared
+ * connection, which is opened on demand and re-opened when it dies.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef H2_H
+#define H2_H
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "./csapp2.h"
+#include "./hpack.h"
+
+namespace h2 {
+
+using hpack::HeaderList;
+
+/**
+ * @brief Thrown when the connection or stream fails
+ *
+ */
+class H2Exception : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+class Connection;
+struct StreamState;
+
+/**
+ * @brief One request/response exchange on a shared connection
+ * Destroying an unfinished stream resets it (RST_STREAM CANCEL).
+ */
+class Stream {
+ private:
+  std::shared_ptr<Connection> conn;
+  std::shared_ptr<StreamState> state;
+
+ public:
+  Stream(std::shared_ptr<Connection> conn, std::shared_ptr<StreamState> state);
+  Stream(const Stream&) = delete;
+  Stream& operator=(const Stream&) = delete;
+  ~Stream();
+
+  /**
+   * @brief Wait for the (final, non-1xx) response header
+   *
+   * @return Response header, including the @c :status pseudo-header
+   */
+  const HeaderList& response_headers();
+
+  /**
+   * @brief Wait for more response body
+   * Consumed bytes are given back to the server as flow-control window.
+   * @param out Received bytes are appended to it
+   * @return How many bytes are appended, 0 on end of stream
+   */
+  std::size_t read(std::vector<char>& out);
+};
+
+/**
+ * @brief Send a request without body on the connection to @c host:port
+ *
+ * @param headers Request header, pseudo-headers ( @c :method , @c :scheme ,
+ * @c :authority , @c :path ) first
+ * @param profile Socket options, used if a new connection is opened
+ * @return The stream to read the response from
+ */
+std::unique_ptr<Stream> request(const std::string& host, std::uint16_t port,
+                                const HeaderList& headers,
+                                const csapp::SocketProfile& profile = {});
+
+}  // namespace h2
+
+#endif  // H2_H
@@ -0,0 +1,164 @@
+/**
+ * @file health.cpp
+ * @author agent (agent@local)
+ * @brief The implementation of origin health tracking
+ * Each origin keeps an EWMA of failure rate and latency. The breaker opens
+ * after several consecutive failures, or when the failure rate is too high;
+ * while open, requests fail fast instead of blocking a thread in connect.
+ * After a cool-down (doubled on every failed probe), one probe request is
+ * let through to decide whether to close the breaker again.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#include "./health.h"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Weight of the newest sample in EWMA
+ *
+ */
+static constexpr const double EWMA_ALPHA{0.2};
+
+/**
+ * @brief Open the breaker after this many consecutive failures
+ *
+ */
+static constexpr const int MAX_CONSECUTIVE_FAILURES{5};
+
+/**
+ * @brief Open the breaker when failure rate exceeds this ...
+ *
+ */
+static constexpr const double MAX_FAILURE_RATE{0.5};
+
+/**
+ * @brief ... and at least this many samples are recorded
+ *
+ */
+static constexpr const int MIN_SAMPLES{10};
+
+/**
+ * @brief Cool-down of the first opening, and its upper bound
+ *
+ */
+static constexpr const std::chrono::milliseconds MIN_COOLDOWN{1000};
+static constexpr const std::chrono::milliseconds MAX_COOLDOWN{30000};
+
+/**
+ * @brief Health state of an origin
+ *
+ */
+struct OriginHealth {
+  CircuitState state{CircuitState::Closed};  ///< State of breaker
+  double failure_rate{0.0};                  ///< EWMA of failure (0 or 1)
+  double latency_us{0.0};                    ///< EWMA of success latency
+  int samples{0};                            ///< Requests reported
+  int consecutive_failures{0};               ///< Failures in a row
+  std::chrono::milliseconds cooldown{MIN_COOLDOWN};  ///< Next cool-down
+  Clock::time_point open_until{};  ///< When Open turns into HalfOpen
+  bool probing{false};             ///< Whether the probe is in flight
+  Clock::time_point probe_start{};  ///< When the probe was let through
+};
+
+/**
+ * @brief Health state of all origins
+ *
+ */
+static std::unordered_map<std::string, OriginHealth> origins;
+
+/**
+ * @brief The mutex for @c origins
+ *
+ */
+static std::mutex origins_mutex;
+
+/**
+ * @brief Open the breaker of @c h
+ *
+ */
+static void trip(const std::string& origin, OriginHealth& h) {
+  h.state = CircuitState::Open;
+  h.open_until = Clock::now() + h.cooldown;
+  h.probing = false;
+  std::clog << "Circuit of " << origin << " opened for "
+            << h.cooldown.count() << "ms (failure rate " << h.failure_rate
+            << ")" << std::endl;
+  h.cooldown = std::min(h.cooldown * 2, MAX_COOLDOWN);
+}
+
+bool health_allow(const std::string& origin) {
+  std::lock_guard lock(origins_mutex);
+  auto it = origins.find(origin);
+  if (it == origins.end()) return true;
+  OriginHealth& h = it->second;
+  switch (h.state) {
+    case CircuitState::Closed:
+      return true;
+    case CircuitState::Open:
+      if (Clock::now() < h.open_until) return false;
+      h.state = CircuitState::HalfOpen;
+      [[fallthrough]];
+    case CircuitState::HalfOpen:
+      if (h.probing) return false;
+      h.probing = true;
+      h.probe_start = Clock::now();
+      return true;
+  }
+  return true;
+}
+
+void health_report(const std::string& origin, bool success,
+                   Clock::time_point start) {
+  const auto latency{
+      std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                             start)};
+  std::lock_guard lock(origins_mutex);
+  OriginHealth& h = origins[origin];
+  // Requests sent before the breaker opened may still fail; only the
+  // probe decides a half-open breaker
+  if (!success && h.state == CircuitState::HalfOpen && start < h.probe_start)
+    return;
+  h.samples++;
+  h.failure_rate += EWMA_ALPHA * ((success ? 0.0 : 1.0) - h.failure_rate);
+  if (success) {
+    h.latency_us += EWMA_ALPHA * (latency.count() - h.latency_us);
+    h.consecutive_failures = 0;
+    if (h.state != CircuitState::Closed) {
+      std::clog << "Circuit of " << origin << " closed" << std::endl;
+      // Forget the bad history, or it trips again immediately
+      h = OriginHealth{};
+      h.latency_us = latency.count();
+    }
+    return;
+  }
+  h.consecutive_failures++;
+  switch (h.state) {
+    case CircuitState::Closed:
+      if (h.consecutive_failures >= MAX_CONSECUTIVE_FAILURES ||
+          (h.samples >= MIN_SAMPLES && h.failure_rate > MAX_FAILURE_RATE))
+        trip(origin, h);
+      break;
+    case CircuitState::HalfOpen:
+      trip(origin, h);
+      break;
+    case CircuitState::Open:
+      // Requests sent before opening may still fail; nothing to do
+      break;
+  }
+}
+
+CircuitState health_state(const std::string& origin) {
+  std::lock_guard lock(origins_mutex);
+  auto it = origins.find(origin);
+  return it == origins.end() ? CircuitState::Closed : it->second.state;
+}
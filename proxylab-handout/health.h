@@ -0,0 +1,87 @@
+/**
+ * @file health.h
+ * @author agent (agent@local)
+ * @brief Origin server health tracking and circuit breaker
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <chrono>
+#include <string>
+
+/**
+ * @brief State of the circuit breaker of an origin
+ * - Closed: origin is healthy, requests pass through
+ * - Open: origin is unhealthy, requests fail fast
+ * - HalfOpen: cool-down expired, one probe request is let through
+ */
+enum class CircuitState { Closed, Open, HalfOpen };
+
+/**
+ * @brief Ask whether a request to @c origin should be sent
+ * In half-open state, only the first caller gets @c true (as the probe); it
+ * must report the result by @c health_report (or @c HealthGuard ).
+ * @param origin The origin, formatted as @c "host:port"
+ * @return @c false if the request should fail fast
+ */
+bool health_allow(const std::string& origin);
+
+/**
+ * @brief Record the result of a request to @c origin
+ * While half-open, a failure only counts if it is of the probe; requests
+ * sent before the breaker opened say nothing about the origin now.
+ * @param origin The origin, formatted as @c "host:port"
+ * @param success Whether the origin responded
+ * @param start When the request started; latency is measured up to now
+ */
+void health_report(const std::string& origin, bool success,
+                   std::chrono::steady_clock::time_point start);
+
+/**
+ * @brief Current state of @c origin's circuit breaker
+ *
+ */
+CircuitState health_state(const std::string& origin);
+
+/**
+ * @brief Report the result of one request to an origin exactly once
+ * Timing starts on construction. If @c succeed is never called (e.g.
+ * connecting failed or an exception is thrown), a failure is reported on
+ * destruction, so a half-open probe never gets lost.
+ */
+class HealthGuard {
+ private:
+  std::string origin;
+  std::chrono::steady_clock::time_point start;
+  bool reported{false};
+
+ public:
+  explicit HealthGuard(const std::string& origin)
+      : origin{origin}, start{std::chrono::steady_clock::now()} {}
+  HealthGuard(const HealthGuard&) = delete;
+  HealthGuard& operator=(const HealthGuard&) = delete;
+  ~HealthGuard() {
+    if (!reported) report(false);
+  }
+  /**
+   * @brief Report success; call it when the first response byte arrives
+   *
+   */
+  void succeed() {
+    if (!reported) report(true);
+  }
+
+ private:
+  void report(bool success) {
+    reported = true;
+    health_report(origin, success, start);
+  }
+};
+
+#endif  // HEALTH_H
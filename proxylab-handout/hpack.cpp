@@ -0,0 +1,428 @@
+/**
+ * @file hpack.cpp
+ * @author agent (agent@local)
+ * @brief The implementation of HPACK
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#include "./hpack.h"
+
+#include <algorithm>
+#include <array>
+
+namespace hpack {
+
+namespace {
+
+/**
+ * @brief Huffman code of each symbol (RFC 7541 Appendix B), 256 is EOS
+ *
+ */
+static constexpr const std::array<std::uint32_t, 257> huffman_codes{
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6,
+    0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea,
+    0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee, 0xfffffef,
+    0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3, 0xffffff4,
+    0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb, 0xf9,
+    0x7fb, 0xfa, 0x16, 0x17, 0x18, 0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21, 0x5d,
+    0x5e, 0x5f, 0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73, 0xfd,
+    0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22, 0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+    0x25, 0x26, 0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76, 0x2c,
+    0x8, 0x9, 0x2d, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd,
+    0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4,
+    0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd,
+    0x7fffde, 0xffffeb, 0x7fffdf, 0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0,
+    0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8,
+    0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+    0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde, 0x7fffea,
+    0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee,
+    0x7fffef, 0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5,
+    0x3fffe6, 0x7ffff1, 0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7,
+    0x7ffff2, 0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+    0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3, 0x3ffffe6,
+    0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2, 0x1fffe4, 0x1fffe5,
+    0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5, 0xfffec,
+    0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea,
+    0x7ffff4, 0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+    0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee,
+    0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff};
+
+/**
+ * @brief Bit length of each Huffman code
+ *
+ */
+static constexpr const std::array<std::uint8_t, 257> huffman_lengths{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28,
+    28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12, 13, 6, 8,
+    11, 10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6,
+    12, 10, 13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 8, 7, 8, 13, 19, 13, 14, 6, 15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6,
+    6, 5, 6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28, 20, 22, 20, 20,
+    22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23,
+    23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21, 23, 22,
+    22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23,
+    22, 22, 23, 26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20,
+    21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26, 27, 26, 26, 27, 27,
+    27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30};
+
+/**
+ * @brief HPACK static table (RFC 7541 Appendix A), 1-indexed
+ *
+ */
+static constexpr const std::array<
+    std::pair<std::string_view, std::string_view>, 61>
+    static_table{{
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}};
+
+/**
+ * @brief Size of an entry in dynamic table (RFC 7541 4.1)
+ *
+ */
+constexpr std::size_t entry_size(std::string_view name,
+                                 std::string_view value) {
+  return name.size() + value.size() + 32;
+}
+
+/**
+ * @brief Node of Huffman decoding tree
+ * Leaf has @c symbol >= 0, inner node has two children.
+ */
+struct HuffmanNode {
+  std::array<std::int16_t, 2> child{-1, -1};
+  std::int16_t symbol{-1};
+};
+
+/**
+ * @brief Get Huffman decoding tree (built on first use), root is @c [0]
+ *
+ */
+const std::vector<HuffmanNode>& huffman_tree() {
+  static const std::vector<HuffmanNode> tree{[] {
+    std::vector<HuffmanNode> tree(1);
+    for (std::size_t sym{0}; sym < huffman_codes.size(); sym++) {
+      std::size_t node{0};
+      for (int bit{huffman_lengths[sym] - 1}; bit >= 0; bit--) {
+        const int b = (huffman_codes[sym] >> bit) & 1;
+        if (tree[node].child[b] < 0) {
+          tree[node].child[b] = static_cast<std::int16_t>(tree.size());
+          tree.emplace_back();
+        }
+        node = tree[node].child[b];
+      }
+      tree[node].symbol = static_cast<std::int16_t>(sym);
+    }
+    return tree;
+  }()};
+  return tree;
+}
+
+/**
+ * @brief Append integer @c value with @c prefix bits (RFC 7541 5.1)
+ * @param first_byte High bits (pattern) of the first byte
+ */
+void encode_int(std::string& out, std::uint8_t first_byte, int prefix,
+                std::size_t value) {
+  const std::size_t max_prefix{(1u << prefix) - 1};
+  if (value < max_prefix) {
+    out += static_cast<char>(first_byte | value);
+    return;
+  }
+  out += static_cast<char>(first_byte | max_prefix);
+  value -= max_prefix;
+  while (value >= 128) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+/**
+ * @brief Append a string literal, Huffman coded if shorter
+ *
+ */
+void encode_string(std::string& out, std::string_view s) {
+  if (const std::size_t len{huffman_length(s)}; len < s.size()) {
+    encode_int(out, 0x80, 7, len);
+    out += huffman_encode(s);
+  } else {
+    encode_int(out, 0x00, 7, s.size());
+    out += s;
+  }
+}
+
+/**
+ * @brief Read integer with @c prefix bits from @c in , advancing it
+ *
+ */
+std::size_t decode_int(std::string_view& in, int prefix) {
+  if (in.empty()) throw HpackException("Truncated integer");
+  const std::size_t max_prefix{(1u << prefix) - 1};
+  std::size_t value{static_cast<std::uint8_t>(in.front()) & max_prefix};
+  in.remove_prefix(1);
+  if (value < max_prefix) return value;
+  for (int shift{0};; shift += 7) {
+    if (in.empty()) throw HpackException("Truncated integer");
+    if (shift > 28) throw HpackException("Integer overflow");
+    const std::uint8_t b = in.front();
+    in.remove_prefix(1);
+    value += static_cast<std::size_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) return value;
+  }
+}
+
+/**
+ * @brief Read a string literal from @c in , advancing it
+ *
+ */
+std::string decode_string(std::string_view& in) {
+  if (in.empty()) throw HpackException("Truncated string");
+  const bool huffman{(in.front() & 0x80) != 0};
+  const std::size_t len{decode_int(in, 7)};
+  if (len > in.size()) throw HpackException("Truncated string");
+  std::string_view raw{in.substr(0, len)};
+  in.remove_prefix(len);
+  return huffman ? huffman_decode(raw) : std::string(raw);
+}
+
+/**
+ * @brief Whether the field should never be put in any table
+ *
+ */
+bool is_sensitive(std::string_view name) {
+  return name == "authorization" || name == "proxy-authorization" ||
+         name == "set-cookie";
+}
+
+}  // namespace
+
+std::string huffman_encode(std::string_view s) {
+  std::string out;
+  std::uint64_t bits{0};
+  int nbits{0};
+  for (unsigned char c : s) {
+    bits = bits << huffman_lengths[c] | huffman_codes[c];
+    nbits += huffman_lengths[c];
+    while (nbits >= 8) {
+      nbits -= 8;
+      out += static_cast<char>(bits >> nbits);
+    }
+  }
+  // Pad with the most significant bits of EOS (all ones)
+  if (nbits > 0)
+    out += static_cast<char>(bits << (8 - nbits) | (0xff >> nbits));
+  return out;
+}
+
+std::size_t huffman_length(std::string_view s) {
+  std::size_t bits{0};
+  for (unsigned char c : s) bits += huffman_lengths[c];
+  return (bits + 7) / 8;
+}
+
+std::string huffman_decode(std::string_view s) {
+  const auto& tree{huffman_tree()};
+  std::string out;
+  std::size_t node{0};
+  int pad_bits{0};      // Bits read since last symbol
+  bool pad_ones{true};  // Whether they are all ones
+  for (unsigned char c : s) {
+    for (int bit{7}; bit >= 0; bit--) {
+      const int b = (c >> bit) & 1;
+      node = tree[node].child[b];
+      pad_bits++;
+      pad_ones = pad_ones && b;
+      if (tree[node].symbol >= 0) {
+        if (tree[node].symbol == 256)
+          throw HpackException("EOS in Huffman string");
+        out += static_cast<char>(tree[node].symbol);
+        node = 0;
+        pad_bits = 0;
+        pad_ones = true;
+      }
+    }
+  }
+  if (pad_bits > 7 || !pad_ones)
+    throw HpackException("Invalid Huffman padding");
+  return out;
+}
+
+void Table::evict(std::size_t target) {
+  while (size > target) {
+    size -= entry_size(entries.back().first, entries.back().second);
+    entries.pop_back();
+  }
+}
+
+void Table::set_max_size(std::size_t max) {
+  max_size = max;
+  evict(max_size);
+}
+
+void Table::add(std::string_view name, std::string_view value) {
+  const std::size_t s{entry_size(name, value)};
+  if (s > max_size) {
+    // Adding an entry larger than table empties it (RFC 7541 4.4)
+    evict(0);
+    return;
+  }
+  evict(max_size - s);
+  entries.emplace_front(name, value);
+  size += s;
+}
+
+std::pair<std::string_view, std::string_view> Table::at(
+    std::size_t index) const {
+  if (index == 0) throw HpackException("Index 0 is not used");
+  if (index <= static_table.size()) return static_table[index - 1];
+  index -= static_table.size() + 1;
+  if (index >= entries.size()) throw HpackException("Index out of range");
+  return entries[index];
+}
+
+std::pair<std::size_t, bool> Table::find(std::string_view name,
+                                         std::string_view value) const {
+  std::size_t name_index{0};
+  for (std::size_t i{0}; i < static_table.size(); i++) {
+    if (static_table[i].first != name) continue;
+    if (static_table[i].second == value) return {i + 1, true};
+    if (!name_index) name_index = i + 1;
+  }
+  for (std::size_t i{0}; i < entries.size(); i++) {
+    if (entries[i].first != name) continue;
+    if (entries[i].second == value) return {i + static_table.size() + 1, true};
+    if (!name_index) name_index = i + static_table.size() + 1;
+  }
+  return {name_index, false};
+}
+
+void Encoder::set_max_table_size(std::size_t max) {
+  max = std::min(max, DEFAULT_TABLE_SIZE);
+  if (max == table.get_max_size()) return;
+  // Must be signaled at the beginning of next header block
+  table.set_max_size(max);
+  pending_size_update = max;
+}
+
+void Encoder::encode(const HeaderList& headers, std::string& out) {
+  if (pending_size_update.has_value()) {
+    encode_int(out, 0x20, 5, pending_size_update.value());
+    pending_size_update.reset();
+  }
+  for (const auto& [name, value] : headers) {
+    const auto [index, exact]{table.find(name, value)};
+    if (exact) {
+      encode_int(out, 0x80, 7, index);
+      continue;
+    }
+    if (is_sensitive(name)) {
+      encode_int(out, 0x10, 4, index);  // Never indexed
+    } else if (name == ":path") {
+      encode_int(out, 0x00, 4, index);  // Without indexing
+    } else {
+      encode_int(out, 0x40, 6, index);  // Incremental indexing
+      table.add(name, value);
+    }
+    if (!index) encode_string(out, name);
+    encode_string(out, value);
+  }
+}
+
+HeaderList Decoder::decode(std::string_view block) {
+  HeaderList headers;
+  while (!block.empty()) {
+    const std::uint8_t b = block.front();
+    if (b & 0x80) {
+      const auto [name, value]{table.at(decode_int(block, 7))};
+      headers.emplace_back(name, value);
+      continue;
+    }
+    if ((b & 0xe0) == 0x20) {
+      const std::size_t size{decode_int(block, 5)};
+      if (size > max_table_size)
+        throw HpackException("Table size update exceeds the limit");
+      table.set_max_size(size);
+      continue;
+    }
+    const bool indexing{(b & 0xc0) == 0x40};
+    const std::size_t index{decode_int(block, indexing ? 6 : 4)};
+    std::string name{index ? std::string(table.at(index).first)
+                           : decode_string(block)};
+    std::string value{decode_string(block)};
+    if (indexing) table.add(name, value);
+    headers.emplace_back(std::move(name), std::move(value));
+  }
+  return headers;
+}
+
+}  // namespace hpack
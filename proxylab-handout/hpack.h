@@ -0,0 +1,139 @@
+/**
+ * @file hpack.h
+ * @author agent (agent@local)
+ * @brief HPACK header compression for HTTP/2 (RFC 7541)
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace hpack {
+
+/**
+ * @brief A list of (name, value) header fields, names are lower-case
+ *
+ */
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * @brief Thrown when a header block cannot be decoded; the HTTP/2
+ * connection should be closed with COMPRESSION_ERROR
+ */
+class HpackException : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Default (and our advertised) size of dynamic table
+ *
+ */
+static constexpr const std::size_t DEFAULT_TABLE_SIZE{4096};
+
+/**
+ * @brief The dynamic table, with static table in front of it
+ * Index 1 ~ 61 are static entries, 62 ~ are dynamic (newest first).
+ */
+class Table {
+ private:
+  std::deque<std::pair<std::string, std::string>> entries{};
+  std::size_t size{0};  ///< Sum of entry sizes (name + value + 32)
+  std::size_t max_size{DEFAULT_TABLE_SIZE};
+
+  void evict(std::size_t target);
+
+ public:
+  void set_max_size(std::size_t max);
+  std::size_t get_max_size() const { return max_size; }
+  void add(std::string_view name, std::string_view value);
+  /**
+   * @brief Get entry by HPACK index, throw if out of range
+   *
+   */
+  std::pair<std::string_view, std::string_view> at(std::size_t index) const;
+  /**
+   * @brief Search for an entry
+   *
+   * @return (index, whether value also matches); index is 0 if not found
+   */
+  std::pair<std::size_t, bool> find(std::string_view name,
+                                    std::string_view value) const;
+};
+
+/**
+ * @brief Encode header lists into header blocks
+ * Fields are added into dynamic table, except those too variable
+ * ( @c :path ) or sensitive ( @c authorization ...). Strings are Huffman
+ * coded when that is shorter.
+ */
+class Encoder {
+ private:
+  Table table{};
+  std::optional<std::size_t> pending_size_update{};
+
+ public:
+  /**
+   * @brief Apply peer's SETTINGS_HEADER_TABLE_SIZE
+   *
+   */
+  void set_max_table_size(std::size_t max);
+  /**
+   * @brief Append the header block of @c headers to @c out
+   *
+   */
+  void encode(const HeaderList& headers, std::string& out);
+};
+
+/**
+ * @brief Decode header blocks into header lists
+ *
+ */
+class Decoder {
+ private:
+  Table table{};
+  std::size_t max_table_size{DEFAULT_TABLE_SIZE};
+
+ public:
+  /**
+   * @brief Decode a whole header block (all CONTINUATION fragments joined)
+   *
+   */
+  HeaderList decode(std::string_view block);
+};
+
+/**
+ * @brief Huffman-encode @c s (RFC 7541 5.2)
+ *
+ */
+std::string huffman_encode(std::string_view s);
+
+/**
+ * @brief Length of @c s after Huffman encoding
+ *
+ */
+std::size_t huffman_length(std::string_view s);
+
+/**
+ * @brief Huffman-decode @c s , throw @c HpackException if malformed
+ *
+ */
+std::string huffman_decode(std::string_view s);
+
+}  // namespace hpack
+
+#endif  // HPACK_H
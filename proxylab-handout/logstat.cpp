@@ -0,0 +1,156 @@
+/**
+ * @file logstat.cpp
+ * @author agent (agent@local)
+ * @brief Offline analyzer of binary access log written by @c proxy -l
+ * Prints hit ratio, bandwidth, latency percentiles, status codes and the
+ * most requested URIs.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./access_log.h"
+#include "./csapp2.h"
+
+/**
+ * @brief Latencies of a group of requests
+ *
+ */
+struct Latencies {
+  std::vector<std::uint32_t> total{};
+  std::vector<std::uint32_t> upstream{};
+
+  /**
+   * @brief Print percentiles; vectors are sorted in place
+   *
+   */
+  void print(const char* name) {
+    if (total.empty()) return;
+    std::sort(total.begin(), total.end());
+    std::sort(upstream.begin(), upstream.end());
+    auto pct{[](const std::vector<std::uint32_t>& v, double p) {
+      if (v.empty()) return std::uint32_t{0};
+      return v[std::min(v.size() - 1, std::size_t(p * v.size()))];
+    }};
+    std::cout << std::left << std::setw(8) << name << std::right;
+    for (double p : {0.5, 0.9, 0.99, 0.999})
+      std::cout << std::setw(10) << pct(total, p);
+    std::cout << std::setw(10) << total.back();
+    if (!upstream.empty())
+      std::cout << "   (first byte p50 " << pct(upstream, 0.5) << ", p99 "
+                << pct(upstream, 0.99) << ")";
+    std::cout << '\n';
+  }
+};
+
+int main(int argc, char** argv) {
+  std::size_t top_n{10};
+  for (int opt; (opt = getopt(argc, argv, "n:")) != -1;) {
+    switch (opt) {
+      case 'n':
+        top_n = std::stoul(optarg);
+        break;
+      default:
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind != 1) {
+    std::cerr << "usage: " << argv[0] << " [-n <top-uris>] <access-log>"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  const std::string path{argv[optind]};
+  try {
+    const AccessLogView log(path);
+
+    std::uint64_t requests{0}, first_us{UINT64_MAX}, last_us{0};
+    std::uint64_t total_bytes{0}, hit_bytes{0};
+    std::map<CacheResult, std::uint64_t> results;
+    std::map<std::uint16_t, std::uint64_t> statuses;
+    // Keyed by URI hash: the same URI may be interned at another offset
+    // after a restart. The offset is kept only to print the URI
+    std::unordered_map<std::uint64_t, std::uint64_t> uri_counts, uri_offsets;
+    Latencies hit_latency, miss_latency, all_latency;
+    for (std::size_t i{0}; i < log.size(); ++i) {
+      const AccessRecord& r{log[i]};
+      if (!r.timestamp_us) continue;
+      ++requests;
+      first_us = std::min(first_us, r.timestamp_us);
+      last_us = std::max<std::uint64_t>(last_us, r.timestamp_us + r.total_us);
+      total_bytes += r.bytes;
+      ++results[r.cache_result];
+      ++statuses[r.status];
+      ++uri_counts[r.uri_hash];
+      uri_offsets.emplace(r.uri_hash, r.uri_offset);
+      all_latency.total.push_back(r.total_us);
+      if (r.cache_result == CacheResult::Hit) {
+        hit_bytes += r.bytes;
+        hit_latency.total.push_back(r.total_us);
+      } else if (r.cache_result == CacheResult::Miss) {
+        miss_latency.total.push_back(r.total_us);
+        if (r.upstream_us) miss_latency.upstream.push_back(r.upstream_us);
+      }
+    }
+    if (!requests) {
+      std::cout << "No requests in " << path << std::endl;
+      return 0;
+    }
+
+    const std::uint64_t hits{results[CacheResult::Hit]};
+    const std::uint64_t misses{results[CacheResult::Miss]};
+    const double seconds{std::max<std::uint64_t>(last_us - first_us, 1) /
+                         1e6};
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Requests : " << requests << " in " << seconds << " s ("
+              << requests / seconds << " req/s)\n";
+    std::cout << "Cache    : " << hits << " hit, " << misses << " miss, "
+              << results[CacheResult::Purge] << " purge, "
+              << results[CacheResult::None] << " other\n";
+    if (hits + misses) {
+      std::cout << "Hit ratio: " << 100.0 * hits / (hits + misses) << "% ("
+                << "byte hit ratio "
+                << (total_bytes ? 100.0 * hit_bytes / total_bytes : 0.0)
+                << "%)\n";
+    }
+    std::cout << "Sent     : " << total_bytes << " bytes ("
+              << total_bytes / seconds / 1024 << " KiB/s)\n";
+
+    std::cout << "\nLatency (us)" << std::setw(6) << "p50" << std::setw(10)
+              << "p90" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+              << std::setw(10) << "max" << '\n';
+    hit_latency.print("hit");
+    miss_latency.print("miss");
+    all_latency.print("all");
+
+    std::cout << "\nStatus\n";
+    for (const auto& [status, n] : statuses)
+      std::cout << "  " << std::setw(3) << status << std::setw(10) << n
+                << '\n';
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> top(
+        uri_counts.begin(), uri_counts.end());
+    top_n = std::min(top_n, top.size());
+    std::partial_sort(top.begin(), top.begin() + top_n, top.end(),
+                      [](const auto& a, const auto& b) {
+                        return a.second > b.second;
+                      });
+    std::cout << "\nTop URIs\n";
+    for (std::size_t i{0}; i < top_n; ++i) {
+      const auto [hash, n]{top[i]};
+      std::cout << std::setw(10) << n << "  " << log.uri(uri_offsets[hash])
+                << '\n';
+    }
+  } catch (const csapp::SystemException& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
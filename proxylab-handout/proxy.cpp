@@ -9,12 +9,20 @@
  *
  */
 #include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
 #include <sstream>
 #include <thread>
 
+#include "./access_log.h"
 #include "./cache.h"
+#include "./chunked.h"
 #include "./csapp2.h"
+#include "./h2.h"
+#include "./health.h"
 
 using namespace std::literals;
 using csapp::MAXLINE;
@@ -86,28 +94,107 @@ static constexpr const std::string_view user_agent{
     "Firefox/10.0.3\r\n"sv};
 
 void deal(int);
+bool serve_hit(int connfd);
 auto parse_uri(const std::string& uri)
     -> std::tuple<std::string, std::string, std::uint16_t>;
+std::string cache_key(
+    const std::tuple<std::string, std::string, std::uint16_t>& info);
+void purge(csapp::Rio& client, int connfd, const std::string& uri,
+           AccessLogEntry& log);
+bool is_loopback_peer(int connfd);
 std::string get_server_header(
     csapp::Rio& client,
     std::tuple<std::string, std::string, std::uint16_t>& info);
+std::optional<CacheContent> relay_response(csapp::RingRio& server,
+                                           int connfd, bool decode_chunked,
+                                           HealthGuard& health,
+                                           AccessLogEntry& log);
+std::optional<CacheContent> relay_h2(
+    const std::tuple<std::string, std::string, std::uint16_t>& info,
+    const std::string& method, const std::string& server_header, int connfd,
+    HealthGuard& health, AccessLogEntry& log);
+std::uint16_t parse_status(std::string_view status_line);
 void response_error(int fd, int code, const std::string_view& msg,
                     const std::string& info = "");
+void abort_response(int connfd, AccessLogEntry& log, int code,
+                    const std::string_view& msg, const std::string& info);
+
+/**
+ * @brief Socket profiles selectable by @c -S , applied to the listening
+ * socket (and so to client sockets accepted from it) and upstream sockets
+ * - @c latency : no Nagle delay, accept only when request has arrived, TCP
+ *   Fast Open, and keep little unsent data queued in kernel
+ * - @c throughput : also large socket buffers and backlog
+ */
+static const std::map<std::string, csapp::SocketProfile> socket_profiles{
+    // nodelay, defer_accept, fastopen, rcvbuf, sndbuf, notsent_lowat, backlog
+    {"default", {}},
+    {"latency", {true, 1, 256, 0, 0, 16384, csapp::LISTENQ}},
+    {"throughput", {true, 1, 256, 1 << 20, 1 << 20, 0, 4096}},
+};
+
+/**
+ * @brief Socket profile in use
+ *
+ */
+static csapp::SocketProfile socket_profile{};
+
+/**
+ * @brief Origins ( @c "host:port" ) that speak HTTP/2 over cleartext
+ * Requests to them are multiplexed over one HTTP/2 connection per origin.
+ */
+static std::set<std::string> h2c_origins;
 
 int main(int argc, char** argv) {
   csapp::Signal(SIGPIPE, SIG_IGN);
-  if (argc != 2) {
-    std::cerr << "usage: " << argv[0] << " <port>" << std::endl;
+  bool huge_pages{false};
+  for (int opt; (opt = getopt(argc, argv, "2:HS:l:")) != -1;) {
+    switch (opt) {
+      case '2': {
+        // Matched against the lowercased origin of each request
+        std::string origin{optarg};
+        std::transform(origin.begin(), origin.end(), origin.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        h2c_origins.insert(origin);
+        break;
+      }
+      case 'H':
+        huge_pages = true;
+        break;
+      case 'S':
+        if (!socket_profiles.count(optarg)) {
+          std::cerr << "Unknown socket profile " << optarg
+                    << " (default, latency, throughput)" << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        socket_profile = socket_profiles.at(optarg);
+        break;
+      case 'l':
+        access_log_open(optarg);
+        break;
+      default:
+        std::exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind != 1) {
+    std::cerr << "usage: " << argv[0]
+              << " [-2 <h2c-host:port>]... [-H] [-S <socket-profile>]"
+                 " [-l <access-log>] <port>"
+              << std::endl;
     std::exit(EXIT_FAILURE);
   }
-  int listenfd{csapp::Open_listenfd(argv[1])};
-  std::clog << "Start listening on port " << argv[1] << std::endl;
+  const char* port{argv[optind]};
+  cache_init(huge_pages);
+  int listenfd{csapp::Open_listenfd(port, socket_profile)};
+  std::clog << "Start listening on port " << port << std::endl;
   while (true) {
     sockaddr_storage client_addr;
     int connfd{csapp::Accept(listenfd, client_addr)};
     const auto [host, port]{csapp::Getnameinfo(client_addr, 0)};
     std::clog << "Accepted connection from " << host << ":" << port
               << std::endl;
+    // Only misses (and hits not answerable at once) go to worker threads
+    if (serve_hit(connfd)) continue;
     std::thread(deal, connfd).detach();
   }
 }
@@ -118,6 +205,8 @@ int main(int argc, char** argv) {
  * @param connfd Connect-file-descriptor
  */
 void deal(int connfd) {
+  // Written to access log when this request ends
+  AccessLogEntry log(connfd);
   try {
     // Client-reading RIO
     csapp::Rio c_r_rio(connfd);
@@ -125,32 +214,45 @@ void deal(int connfd) {
     std::istringstream iss(c_r_rio.readlineb(MAXLINE));
     std::string method, uri, version;
     iss >> method >> uri >> version;
+    log.parsed();
     if (uri.size() > 5000) {
-      response_error(connfd, 414, "Request-URI Too Long");
+      response_error(connfd, log.record.status = 414, "Request-URI Too Long");
       return;
     }
+    log.uri = uri;
     if (iss.fail()) {
-      response_error(connfd, 400, "Bad Request");
+      response_error(connfd, log.record.status = 400, "Bad Request");
       return;
     }
     std::clog << "Method : " << method << '\n';
     std::clog << "URI    : " << uri << '\n';
     std::clog << "Version: " << version << '\n';
+    if (method == "PURGE") {
+      purge(c_r_rio, connfd, uri, log);
+      return;
+    }
     if (method != "GET") {
-      response_error(connfd, 501, "Not Implemented",
+      response_error(connfd, log.record.status = 501, "Not Implemented",
                      "This proxy cannot deal with non-GET requests.");
       return;
     }
+    auto line_info{parse_uri(uri)};
+    const std::string key{cache_key(line_info)};
+    log.uri = key;
     // Get cache
-    if (auto cache_read = cache_get(uri); cache_read.has_value()) {
+    if (auto cache_read = cache_get(key); cache_read.has_value()) {
       std::clog << "URI \"" << uri << "\" cached. Writing...";
-      csapp::Rio::writen(connfd, cache_read.value().data(),
-                         cache_read.value().size());
+      const CacheContent& content{cache_read.value()};
+      log.record.cache_result = CacheResult::Hit;
+      log.record.status = parse_status(
+          {content.data(), std::min(content.size(), std::size_t{16})});
+      csapp::Rio::writen(connfd, content.data(), content.size());
+      log.record.bytes = content.size();
       csapp::Close(connfd);
       std::clog << "Done" << std::endl;
       return;
     }
-    auto line_info{parse_uri(uri)};
+    log.record.cache_result = CacheResult::Miss;
     // Get request header
     const std::string server_header = get_server_header(c_r_rio, line_info);
     // Split request line from client, and make request line to server
@@ -158,51 +260,67 @@ void deal(int connfd) {
     std::clog << "Host: " << host << '\n'
               << "Path: " << path << '\n'
               << "Port: " << port << '\n';
-    const std::string server_line = method + ' ' + path + " HTTP/1.0\r\n";
+    const std::string server_line = method + ' ' + path + " HTTP/1.1\r\n";
     std::clog << server_line << server_header << std::endl;
-    // Open connection to server
-    int server_fd{
-        csapp::open_clientfd(host.c_str(), std::to_string(port).c_str())};
-    // Server-reading RIO
-    csapp::Rio s_r_rio(server_fd);
-    // Send request line and request header to server
-    csapp::Rio::writen(server_fd, server_line);
-    csapp::Rio::writen(server_fd, server_header);
-    CacheContent cache_write{};  //< Content will be writen to cache
-    std::size_t cache_size{0};   //< How many bytes cached
-    bool enable_cache{true};     //< Whether this response will be cached
-    // std::string is not good for storing binary stream
-    for (std::array<char, MAXLINE> line{};
-         size_t size = s_r_rio.readlineb(line.data(), MAXLINE);) {
-      std::clog << "Recieve " << size << " bytes\n";
-      csapp::Rio::writen(connfd, line.data(), size);
-      if ((enable_cache = cache_size + size < MAX_OBJECT_SIZE)) {
-        std::copy(line.begin(), line.begin() + size,
-                  cache_write.begin() + cache_size);
-        cache_size += size;
-      }
+    // Fail fast if the origin is known to be down; host is case-insensitive
+    std::string origin;
+    std::transform(host.begin(), host.end(), std::back_inserter(origin),
+                   [](unsigned char c) { return std::tolower(c); });
+    origin += ':' + std::to_string(port);
+    if (!health_allow(origin)) {
+      std::clog << "Circuit of " << origin << " is open" << std::endl;
+      response_error(connfd, log.record.status = 503, "Service Unavailable",
+                     "Origin " + origin + " is unhealthy, retry later.");
+      return;
+    }
+    // Failure is reported if no response byte is received
+    HealthGuard health(origin);
+    std::optional<CacheContent> cache_write;
+    if (h2c_origins.count(origin)) {
+      cache_write =
+          relay_h2(line_info, method, server_header, connfd, health, log);
+    } else {
+      // Open connection to server
+      int server_fd{csapp::Open_clientfd(
+          host.c_str(), std::to_string(port).c_str(), socket_profile)};
+      // Server-reading RIO, response is parsed inside its buffer
+      csapp::RingRio s_r_rio(server_fd);
+      // Send request line and request header to server
+      csapp::Rio::writen(server_fd, server_line);
+      csapp::Rio::writen(server_fd, server_header);
+      // HTTP/1.0 client cannot understand chunked body
+      cache_write = relay_response(s_r_rio, connfd, version != "HTTP/1.1",
+                                   health, log);
+      csapp::Close(server_fd);
     }
-    csapp::Close(server_fd);
     csapp::Close(connfd);
     // Set cache
-    if (enable_cache) {
+    if (cache_write.has_value()) {
       std::clog << "Setting cache for \"" << uri << "\"...";
-      cache_set(uri, cache_write);
+      cache_set(key, cache_write.value());
       std::clog << "Done." << std::endl;
     }
   } catch (const csapp::GaiException& e) {
     // Exceptions from get_addr_info
     std::cerr << "Catch GAI exception: " << e.what() << std::endl;
-    response_error(connfd, e.getHTTPStatus().first, e.getHTTPStatus().second,
-                   e.what());
+    abort_response(connfd, log, e.getHTTPStatus().first,
+                   e.getHTTPStatus().second, e.what());
   } catch (const csapp::SystemException& e) {
     // Exceptions from syscall/csapp-func, like RIO etc.
     std::cerr << "Catch system exception: " << e.what() << std::endl;
-    response_error(connfd, 500, "Internal Server Error", e.what());
+    abort_response(connfd, log, 500, "Internal Server Error", e.what());
+  } catch (const h2::H2Exception& e) {
+    // HTTP/2 origin refused or dropped the request
+    std::cerr << "Catch HTTP/2 exception: " << e.what() << std::endl;
+    abort_response(connfd, log, 503, "Service Unavailable", e.what());
+  } catch (const ChunkedException& e) {
+    // Origin sent a malformed chunked body, after its head was relayed
+    std::cerr << "Catch chunked exception: " << e.what() << std::endl;
+    abort_response(connfd, log, 502, "Bad Gateway", e.what());
   } catch (const std::exception& e) {
     // Exceptions from other-func, like string parsing error
     std::cerr << "Catch exception: " << e.what() << std::endl;
-    response_error(connfd, 500, "Internal Server Error", e.what());
+    abort_response(connfd, log, 500, "Internal Server Error", e.what());
   } catch (...) {
     // Should never happened
     std::cerr << "Catch unrecognized exception." << std::endl;
@@ -210,6 +328,68 @@ void deal(int connfd) {
   }
 }
 
+/**
+ * @brief Answer a cache hit on the accepting thread, without blocking
+ * The request is only peeked at, so that it is left intact for @c deal if
+ * this is not a hit, or the request has not fully arrived yet. Response
+ * that does not fit in the socket buffer is finished by a new thread.
+ * @param connfd Connect-file-descriptor
+ * @return Whether the request is taken over
+ */
+bool serve_hit(int connfd) {
+  const auto start{std::chrono::steady_clock::now()};
+  char buf[MAXLINE];
+  const ssize_t n{recv(connfd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT)};
+  if (n <= 0) return false;
+  const std::string_view request(buf, n);
+  const auto header_end{request.find("\r\n\r\n")};
+  if (header_end == std::string_view::npos) return false;
+  std::istringstream iss(std::string(request.substr(0, request.find('\n'))));
+  std::string method, uri, version;
+  iss >> method >> uri >> version;
+  if (iss.fail() || method != "GET" || uri.size() > 5000) return false;
+  const auto parsed{std::chrono::steady_clock::now()};
+  std::string key;
+  try {
+    key = cache_key(parse_uri(uri));
+  } catch (const std::exception& e) {
+    return false;
+  }
+  ssize_t sent{0};
+  std::vector<char> rest;
+  std::uint16_t status{0};
+  const bool hit{cache_visit(key, [&](const char* data, std::size_t size) {
+    sent = send(connfd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) sent = 0;
+    rest.assign(data + sent, data + size);
+    status = parse_status({data, std::min(size, std::size_t{16})});
+  })};
+  if (!hit) return false;
+  {
+    AccessLogEntry log(connfd, start);
+    log.parsed(parsed);
+    log.uri = key;
+    log.record.cache_result = CacheResult::Hit;
+    log.record.status = status;
+    log.record.bytes = sent + rest.size();
+  }
+  // Drain the request, or closing would reset the connection
+  recv(connfd, buf, header_end + 4, MSG_DONTWAIT);
+  if (rest.empty()) {
+    csapp::Close(connfd);
+  } else {
+    std::thread([connfd, rest{std::move(rest)}]() {
+      try {
+        csapp::Rio::writen(connfd, rest.data(), rest.size());
+      } catch (const csapp::SystemException& e) {
+        std::cerr << "Catch system exception: " << e.what() << std::endl;
+      }
+      csapp::Close(connfd);
+    }).detach();
+  }
+  return true;
+}
+
 /**
  * @brief Parse URI to three part
  * Split URI to 3 part:
@@ -244,6 +424,109 @@ auto parse_uri(const std::string& uri)
   return std::make_tuple(host, path, port);
 }
 
+/**
+ * @brief Normalize a parsed URI as the key of cache
+ * The key looks like @c "host:port/path" , with @c host lower-cased, so
+ * that all objects of one host share the prefix @c "host:port/" .
+ * @param info Parsed (host, path, port) from @c parse_uri
+ * @return The cache key
+ */
+std::string cache_key(
+    const std::tuple<std::string, std::string, std::uint16_t>& info) {
+  const auto& [host, path, port]{info};
+  std::string key;
+  std::transform(host.begin(), host.end(), std::back_inserter(key),
+                 [](unsigned char c) { return std::tolower(c); });
+  return key + ':' + std::to_string(port) + path;
+}
+
+/**
+ * @brief Deal with @c PURGE request, which invalidates cache
+ * Only accepted from loopback address. The URI decides the scope:
+ * - @c "http://host/path" : exactly this object
+ * - @c "http://host/path*" : all objects whose path starts with @c "/path"
+ * - @c "http://host/" followed by @c "*" : all objects of this host
+ * @param client RIO object to read request header from client
+ * @param connfd Client connect-file-descriptor
+ * @param uri URI in request line
+ * @param log Access log entry of this request
+ */
+void purge(csapp::Rio& client, int connfd, const std::string& uri,
+           AccessLogEntry& log) {
+  // Request header is useless, but drain it before responding
+  while (utils::rtrim(client.readlineb(MAXLINE)).size())
+    ;
+  log.record.cache_result = CacheResult::Purge;
+  if (!is_loopback_peer(connfd)) {
+    response_error(connfd, log.record.status = 403, "Forbidden",
+                   "PURGE is only allowed from localhost.");
+    return;
+  }
+  const bool is_prefix{!uri.empty() && uri.back() == '*'};
+  const std::string key{
+      cache_key(parse_uri(is_prefix ? uri.substr(0, uri.size() - 1) : uri))};
+  std::vector<std::string> removed;
+  if (is_prefix) {
+    removed = cache_purge_prefix(key);
+  } else if (cache_purge(key)) {
+    removed.push_back(key);
+  }
+  const std::size_t purged{removed.size()};
+  // Log one record per purged object, so that replaying the log purges
+  // them too; this request is the record of the first one
+  log.uri = purged ? removed.front() : is_prefix ? key + '*' : key;
+  std::clog << "Purged " << purged << " object(s) for \"" << key << "\""
+            << std::endl;
+  if (purged == 0) {
+    response_error(connfd, log.record.status = 404, "Not Found",
+                   "Nothing cached for " + uri);
+    return;
+  }
+  const std::string content{"Purged " + std::to_string(purged) +
+                            " object(s)\n"};
+  std::ostringstream oss;
+  oss << "HTTP/1.0 200 OK\r\n"
+      << "Content-Type: text/plain\r\n"
+      << "Content-Length: " << content.size() << "\r\n"
+      << "\r\n"
+      << content;
+  log.record.status = 200;
+  log.record.bytes = oss.str().size();
+  csapp::Rio::writen(connfd, oss.str());
+  csapp::Close(connfd);
+  AccessRecord record{log.record};
+  record.bytes = 0;
+  try {
+    for (std::size_t i{1}; i < purged; ++i)
+      access_log_write(record, removed[i]);
+  } catch (const std::exception& e) {
+    // Logging should never break serving
+  }
+}
+
+/**
+ * @brief Whether the client of @c connfd connects from loopback address
+ *
+ * @param connfd Client connect-file-descriptor
+ */
+bool is_loopback_peer(int connfd) {
+  sockaddr_storage addr;
+  socklen_t len{sizeof(addr)};
+  if (getpeername(connfd, reinterpret_cast<csapp::SA*>(&addr), &len) < 0)
+    return false;
+  if (addr.ss_family == AF_INET) {
+    const auto& in{reinterpret_cast<const sockaddr_in&>(addr)};
+    return (ntohl(in.sin_addr.s_addr) >> 24) == 127;
+  }
+  if (addr.ss_family == AF_INET6) {
+    const auto& in6{reinterpret_cast<const sockaddr_in6&>(addr)};
+    return IN6_IS_ADDR_LOOPBACK(&in6.sin6_addr) ||
+           (IN6_IS_ADDR_V4MAPPED(&in6.sin6_addr) &&
+            in6.sin6_addr.s6_addr[12] == 127);
+  }
+  return false;
+}
+
 /**
  * @brief Get request header from client, while making new request header
  * Dealing with special rules on @c Host: , @c Connection: , @c User-Agent: etc.
@@ -269,7 +552,10 @@ std::string get_server_header(
   }
   // If original request don't have Host, add it from parsed URI
   if (!has_host) {
-    oss << std::get<0>(info) << "\r\n";
+    const auto& [host, path, port]{info};
+    oss << "Host: " << host;
+    if (port != 80) oss << ':' << port;
+    oss << "\r\n";
   }
   oss << "Connection: close\r\n"
       << "Proxy-Connection: close\r\n"
@@ -277,6 +563,230 @@ std::string get_server_header(
   return oss.str();
 }
 
+/**
+ * @brief Relay response from server to client, and make the cache object
+ * A chunked body is decoded on the fly: if @c decode_chunked , the client
+ * receives the decoded body (whose end is marked by closing connection);
+ * otherwise it receives the chunks as is. The cache object always holds the
+ * decoded body, framed by @c Content-Length instead.
+ * @param server RIO object to read response from server
+ * @param connfd Client connect-file-descriptor
+ * @param decode_chunked Whether to send decoded body to client
+ * @param health Reports success when the first byte arrives
+ * @param log Access log entry, status and bytes sent are recorded
+ * @return The object to be cached, or std::nullopt if not cacheable
+ */
+std::optional<CacheContent> relay_response(csapp::RingRio& server,
+                                           int connfd, bool decode_chunked,
+                                           HealthGuard& health,
+                                           AccessLogEntry& log) {
+  CacheContent cache_write{};  //< Content will be writen to cache
+  bool enable_cache{true};     //< Whether this response will be cached
+  auto send{[&](std::string_view data) {
+    csapp::Rio::writen(connfd, data);
+    log.record.bytes += data.size();
+  }};
+  auto append_cache{[&](const char* data, std::size_t size) {
+    if ((enable_cache = enable_cache &&
+                        cache_write.size() + size <= MAX_OBJECT_SIZE)) {
+      cache_write.insert(cache_write.end(), data, data + size);
+    }
+  }};
+  // Status line and response header
+  std::vector<std::string> head;
+  bool is_chunked{false};
+  bool head_complete{false};  //< Whether header terminator was read
+  while (true) {
+    const std::string_view line{server.peekline(MAXLINE)};
+    if (line.empty()) break;
+    std::clog << "Recieve " << line.size() << " bytes\n";
+    health.succeed();
+    log.first_byte();
+    head.emplace_back(line);
+    server.consume(line.size());
+    if (utils::starts_with(head.back(), "Transfer-Encoding:"sv)) {
+      std::string value{head.back().substr(18)};
+      std::transform(value.begin(), value.end(), value.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      is_chunked = value.find("chunked") != std::string::npos;
+    }
+    if (head.size() > 1 && utils::trim(std::string(head.back())).empty()) {
+      head_complete = true;
+      break;
+    }
+  }
+  if (!head.empty()) log.record.status = parse_status(head.front());
+  // A head cut by closed connection is relayed as is, but not cached
+  enable_cache = head_complete;
+  if (!is_chunked || !head_complete) {
+    // Body is either delimited by Content-Length or by closing connection
+    for (const auto& i : head) {
+      send(i);
+      append_cache(i.data(), i.size());
+    }
+    // Relay straight from the buffer of server RIO
+    for (std::string_view data; !(data = server.peek()).empty();
+         server.consume(data.size())) {
+      std::clog << "Recieve " << data.size() << " bytes\n";
+      send(data);
+      append_cache(data.data(), data.size());
+    }
+    if (!enable_cache) return std::nullopt;
+    return cache_write;
+  }
+  // Chunked body: Transfer-Encoding & Content-Length no longer valid after
+  // decoding, drop them (header terminator is the last line of head)
+  std::string cache_head;
+  for (auto i{head.begin()}; i != head.end() - 1; ++i) {
+    const bool is_framing{utils::starts_with(*i, "Transfer-Encoding:"sv) ||
+                          utils::starts_with(*i, "Content-Length:"sv)};
+    if (!is_framing) cache_head += *i;
+    if (!is_framing || !decode_chunked) send(*i);
+  }
+  send(head.back());
+  ChunkedDecoder decoder;
+  std::vector<char> body;
+  std::vector<char> decoded;
+  while (!decoder.done()) {
+    const std::string_view data{server.peek()};
+    if (data.empty()) {
+      std::clog << "Server closed in the middle of chunked body" << std::endl;
+      return std::nullopt;
+    }
+    decoded.clear();
+    const std::size_t used{decoder.feed(data.data(), data.size(), decoded)};
+    if (decode_chunked)
+      send({decoded.data(), decoded.size()});
+    else
+      send(data.substr(0, used));
+    server.consume(used);
+    if ((enable_cache = enable_cache && cache_head.size() + decoder.size() <=
+                                            MAX_OBJECT_SIZE)) {
+      body.insert(body.end(), decoded.begin(), decoded.end());
+    }
+  }
+  std::clog << "Decoded " << decoder.size() << " bytes of chunked body\n";
+  if (!enable_cache) return std::nullopt;
+  cache_head += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+  append_cache(cache_head.data(), cache_head.size());
+  append_cache(body.data(), body.size());
+  if (!enable_cache) return std::nullopt;
+  return cache_write;
+}
+
+/**
+ * @brief Send request to an HTTP/2 origin, and relay response to client
+ * The request header made for HTTP/1 is translated to HTTP/2 fields; the
+ * response is sent back as HTTP/1.0, whose end is marked by closing
+ * connection. The cache object is framed by @c Content-Length .
+ * @param info Parsed (host, path, port) from @c parse_uri
+ * @param method Request method
+ * @param server_header Request header from @c get_server_header
+ * @param connfd Client connect-file-descriptor
+ * @param health Reports success when response header arrives
+ * @param log Access log entry, status and bytes sent are recorded
+ * @return The object to be cached, or std::nullopt if not cacheable
+ */
+std::optional<CacheContent> relay_h2(
+    const std::tuple<std::string, std::string, std::uint16_t>& info,
+    const std::string& method, const std::string& server_header, int connfd,
+    HealthGuard& health, AccessLogEntry& log) {
+  const auto& [host, path, port]{info};
+  // Connection-specific fields are not allowed in HTTP/2
+  auto is_hop_by_hop{[](const std::string& name) {
+    return name == "connection" || name == "proxy-connection" ||
+           name == "keep-alive" || name == "transfer-encoding" ||
+           name == "upgrade" || name == "te";
+  }};
+  h2::HeaderList request{
+      {":method", method}, {":scheme", "http"}, {":authority", ""},
+      {":path", path}};
+  std::istringstream iss(server_header);
+  for (std::string line; std::getline(iss, line);) {
+    const auto colon_pos{line.find(':')};
+    if (colon_pos == std::string::npos) continue;
+    std::string name{line.substr(0, colon_pos)};
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    std::string value{utils::trim(line.substr(colon_pos + 1))};
+    if (name == "host")
+      request[2].second = std::move(value);
+    else if (!is_hop_by_hop(name))
+      request.emplace_back(std::move(name), std::move(value));
+  }
+  auto stream{h2::request(host, port, request, socket_profile)};
+  const auto& response{stream->response_headers()};
+  health.succeed();
+  log.first_byte();
+  std::string head{"HTTP/1.0 "};
+  for (const auto& [name, value] : response) {
+    if (name == ":status") head += value + " \r\n";
+  }
+  log.record.status = parse_status(head);
+  for (const auto& [name, value] : response) {
+    if (name.front() != ':' && name != "content-length" &&
+        !is_hop_by_hop(name))
+      head += name + ": " + value + "\r\n";
+  }
+  const std::string client_head{head + "Connection: close\r\n\r\n"};
+  csapp::Rio::writen(connfd, client_head);
+  log.record.bytes += client_head.size();
+  std::vector<char> body;
+  bool enable_cache{true};
+  for (std::vector<char> data; stream->read(data); data.clear()) {
+    std::clog << "Recieve " << data.size() << " bytes\n";
+    csapp::Rio::writen(connfd, data.data(), data.size());
+    log.record.bytes += data.size();
+    if ((enable_cache = enable_cache &&
+                        head.size() + body.size() + data.size() <=
+                            MAX_OBJECT_SIZE)) {
+      body.insert(body.end(), data.begin(), data.end());
+    }
+  }
+  if (!enable_cache) return std::nullopt;
+  head += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+  if (head.size() + body.size() > MAX_OBJECT_SIZE) return std::nullopt;
+  CacheContent cache_write(head.begin(), head.end());
+  cache_write.insert(cache_write.end(), body.begin(), body.end());
+  return cache_write;
+}
+
+/**
+ * @brief Get status code from status line like @c "HTTP/1.1 200 OK"
+ *
+ * @return The status code, or 0 if malformed
+ */
+std::uint16_t parse_status(std::string_view status_line) {
+  const auto space_pos{status_line.find(' ')};
+  if (space_pos == std::string_view::npos) return 0;
+  std::uint16_t code{0};
+  for (auto i{space_pos + 1}; i < status_line.size() && code < 1000; ++i) {
+    if (!std::isdigit(static_cast<unsigned char>(status_line[i]))) break;
+    code = code * 10 + (status_line[i] - '0');
+  }
+  return code < 1000 ? code : 0;
+}
+
+/**
+ * @brief Answer a failed request with an error page, or only close the
+ * connection if part of a response was sent: a page after it would be read
+ * as the rest of the body, while closing tells client the response is cut.
+ * @param connfd Connect-file-descriptor
+ * @param log Access log entry, status is recorded if a page is sent
+ * @param code Status code of error page
+ * @param msg Reason phrase of error page
+ * @param info Detailed description
+ */
+void abort_response(int connfd, AccessLogEntry& log, int code,
+                    const std::string_view& msg, const std::string& info) {
+  if (!log.record.bytes) {
+    response_error(connfd, log.record.status = code, msg, info);
+    return;
+  }
+  // Not the throwing wrapper, as this runs in an exception handler
+  close(connfd);
+}
+
 /**
  * @brief Returning error to client
  * If error occurs in this stage, do nothing.
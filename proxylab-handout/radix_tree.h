@@ -0,0 +1,236 @@
+/**
+ * @file radix_tree.h
+ * @author agent (agent@local)
+ * @brief A compressed radix tree (Patricia trie) keyed by strings
+ * Used by the cache as an URI index, so that prefix purging only visits
+ * the matching subtree instead of scanning every cache block.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026 agent
+ *
+ */
+
+#ifndef RADIX_TREE_H
+#define RADIX_TREE_H
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Compressed radix tree mapping string keys to @c T
+ * Each edge carries a (non-empty) label; a node has at most one child for
+ * each leading character. Nodes without value have at least two children
+ * (except the root), so the tree stays compressed after erasing.
+ * Not thread-safe; the caller should protect it.
+ * @tparam T Type of the stored value
+ */
+template <typename T>
+class RadixTree {
+ private:
+  struct Node {
+    std::string label{};                          ///< Edge label from parent
+    std::optional<T> value{};                     ///< Value if a key ends here
+    std::map<char, std::unique_ptr<Node>> children{};  ///< Keyed by 1st char
+  };
+
+  Node root{};
+  std::size_t count{0};
+
+  /**
+   * @brief Length of the common prefix of @c a and @c b
+   */
+  static std::size_t common_prefix(std::string_view a, std::string_view b) {
+    std::size_t i{0};
+    while (i < a.size() && i < b.size() && a[i] == b[i]) i++;
+    return i;
+  }
+
+  /**
+   * @brief Merge @c node with its only child if @c node carries no value
+   */
+  static void compress(Node& node) {
+    if (node.value.has_value() || node.children.size() != 1) return;
+    std::unique_ptr<Node> child{std::move(node.children.begin()->second)};
+    node.label += child->label;
+    node.value = std::move(child->value);
+    node.children = std::move(child->children);
+  }
+
+  /**
+   * @brief Call @c f(key, value) for every value in subtree @c node
+   * @param path Key of @c node (including its label)
+   */
+  template <typename F>
+  static void visit(const Node& node, std::string& path, F& f) {
+    if (node.value.has_value()) f(std::string_view(path), *node.value);
+    for (const auto& [c, child] : node.children) {
+      path += child->label;
+      visit(*child, path, f);
+      path.resize(path.size() - child->label.size());
+    }
+  }
+
+ public:
+  /**
+   * @brief Number of keys in the tree
+   */
+  std::size_t size() const { return count; }
+
+  /**
+   * @brief Insert or overwrite @c key
+   *
+   * @return Whether @c key was newly inserted
+   */
+  bool insert(std::string_view key, T value) {
+    Node* node{&root};
+    while (true) {
+      if (key.empty()) {
+        bool inserted{!node->value.has_value()};
+        node->value = std::move(value);
+        count += inserted;
+        return inserted;
+      }
+      auto it{node->children.find(key.front())};
+      if (it == node->children.end()) {
+        auto leaf{std::make_unique<Node>()};
+        leaf->label = std::string(key);
+        leaf->value = std::move(value);
+        node->children.emplace(key.front(), std::move(leaf));
+        count++;
+        return true;
+      }
+      Node* child{it->second.get()};
+      std::size_t n{common_prefix(key, child->label)};
+      if (n < child->label.size()) {
+        // Split the edge: node -> mid -> child
+        auto mid{std::make_unique<Node>()};
+        mid->label = child->label.substr(0, n);
+        child->label.erase(0, n);
+        mid->children.emplace(child->label.front(), std::move(it->second));
+        it->second = std::move(mid);
+        child = it->second.get();
+      }
+      node = child;
+      key.remove_prefix(n);
+    }
+  }
+
+  /**
+   * @brief Find the value of @c key
+   *
+   * @return The value, or std::nullopt if not exists
+   */
+  std::optional<T> find(std::string_view key) const {
+    const Node* node{&root};
+    while (!key.empty()) {
+      auto it{node->children.find(key.front())};
+      if (it == node->children.end()) return std::nullopt;
+      const Node* child{it->second.get()};
+      if (key.substr(0, child->label.size()) != child->label)
+        return std::nullopt;
+      key.remove_prefix(child->label.size());
+      node = child;
+    }
+    return node->value;
+  }
+
+  /**
+   * @brief Remove @c key from the tree
+   *
+   * @return The removed value, or std::nullopt if @c key not exists
+   */
+  std::optional<T> erase(std::string_view key) {
+    Node* parent{nullptr};
+    Node* node{&root};
+    while (!key.empty()) {
+      auto it{node->children.find(key.front())};
+      if (it == node->children.end()) return std::nullopt;
+      Node* child{it->second.get()};
+      if (key.substr(0, child->label.size()) != child->label)
+        return std::nullopt;
+      key.remove_prefix(child->label.size());
+      parent = node;
+      node = child;
+    }
+    if (!node->value.has_value()) return std::nullopt;
+    std::optional<T> result{std::move(node->value)};
+    node->value.reset();
+    count--;
+    if (parent) {
+      if (node->children.empty()) {
+        parent->children.erase(node->label.front());
+      } else {
+        compress(*node);
+      }
+      if (parent != &root) compress(*parent);
+    }
+    return result;
+  }
+
+  /**
+   * @brief Call @c f(key, value) for every key starting with @c prefix
+   */
+  template <typename F>
+  void for_each_prefix(std::string_view prefix, F&& f) const {
+    const Node* node{&root};
+    std::string path;
+    while (!prefix.empty()) {
+      auto it{node->children.find(prefix.front())};
+      if (it == node->children.end()) return;
+      const Node* child{it->second.get()};
+      std::size_t n{common_prefix(prefix, child->label)};
+      if (n < prefix.size() && n < child->label.size()) return;
+      path += child->label;
+      prefix.remove_prefix(n);
+      node = child;
+    }
+    visit(*node, path, f);
+  }
+
+  /**
+   * @brief Remove every key starting with @c prefix
+   * Only the subtree below @c prefix is touched.
+   * @return Removed (key, value) pairs
+   */
+  std::vector<std::pair<std::string, T>> erase_prefix(std::string_view prefix) {
+    std::vector<std::pair<std::string, T>> removed;
+    auto collect{[&removed](std::string_view k, const T& v) {
+      removed.emplace_back(std::string(k), v);
+    }};
+    if (prefix.empty()) {
+      std::string path;
+      visit(root, path, collect);
+      root = Node{};
+      count = 0;
+      return removed;
+    }
+    Node* parent{nullptr};
+    Node* node{&root};
+    std::string path;
+    while (!prefix.empty()) {
+      auto it{node->children.find(prefix.front())};
+      if (it == node->children.end()) return removed;
+      Node* child{it->second.get()};
+      std::size_t n{common_prefix(prefix, child->label)};
+      if (n < prefix.size() && n < child->label.size()) return removed;
+      path += child->label;
+      prefix.remove_prefix(n);
+      parent = node;
+      node = child;
+    }
+    visit(*node, path, collect);
+    count -= removed.size();
+    parent->children.erase(node->label.front());
+    if (parent != &root) compress(*parent);
+    return removed;
+  }
+};
+
+#endif  // RADIX_TREE_H